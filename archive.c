@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "archive.h"
+#include "encode.h"
+#include "decode.h"
+#include "lz.h"
+#include "common.h"
+#include "types.h"
+
+/* Member bytes extracted and written per step */
+#define ARCHIVE_COPY_SIZE (1024 * 1024)
+
+/*Function to write little endian 32 bit value*/
+static void write_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/*Function to read little endian 32 bit value*/
+static uint32_t read_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*Function to check a member name is a plain file name*/
+static int valid_member_name(const char *name, size_t len)
+{
+    if (len == 0 || len > ARCHIVE_MAX_NAME || memchr(name, '/', len) || memchr(name, '\0', len))
+        return 0;
+    return !(len == 1 && name[0] == '.') && !(len == 2 && name[0] == '.' && name[1] == '.');
+}
+
+/*Function to read a whole member file*/
+static Status read_member_file(const char *fname, char **data, long *size)
+{
+    FILE *fptr = fopen(fname, "r");
+
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", fname);
+        return e_failure;
+    }
+    fseek(fptr, 0, SEEK_END);
+    *size = ftell(fptr);
+    fseek(fptr, 0, SEEK_SET);
+    *data = malloc(*size ? *size : 1);
+    if (*data == NULL || fread(*data, 1, *size, fptr) != (size_t)*size)
+    {
+        fprintf(stderr, "ERROR: Unable to read file %s\n", fname);
+        fclose(fptr);
+        free(*data);
+        *data = NULL;
+        return e_failure;
+    }
+    fclose(fptr);
+    return e_success;
+}
+
+/*Function to build archive payload of nfiles files, index first*/
+static Status build_archive(char *files[], int nfiles, int compress, char **payload, long *payload_size)
+{
+    ArchiveMember *members = calloc(nfiles, sizeof(ArchiveMember));
+    char **data = calloc(nfiles, sizeof(char *));
+    long index_size = ARCHIVE_HEAD_SIZE, total;
+    unsigned char *p;
+    Status ret = e_failure;
+    int i;
+
+    if (members == NULL || data == NULL)
+        goto out;
+
+    //read, and compress if asked, every member
+    for (i = 0; i < nfiles; i++)
+    {
+        const char *name = strrchr(files[i], '/') ? strrchr(files[i], '/') + 1 : files[i];
+        long size;
+        int j;
+
+        if (!valid_member_name(name, strlen(name)))
+        {
+            fprintf(stderr, "ERROR: %s has no usable file name\n", files[i]);
+            goto out;
+        }
+        //members are looked up by name, a second one of the same name could never be extracted
+        for (j = 0; j < i && strcmp(members[j].name, name) != 0; j++)
+            ;
+        if (j < i)
+        {
+            fprintf(stderr, "ERROR: %s and %s are both stored as member %s\n", files[j], files[i], name);
+            goto out;
+        }
+        strcpy(members[i].name, name);
+        if (read_member_file(files[i], &data[i], &size) != e_success)
+            goto out;
+        if (size > UINT32_MAX)
+            goto out;
+        members[i].raw_size = members[i].size = size;
+
+        //each member on its own, so it can still be read alone
+        if (compress)
+        {
+            char *packed = malloc(lz_compress_bound(size));
+            long packed_size;
+
+            if (packed == NULL)
+                goto out;
+            packed_size = lz_compress(data[i], size, packed);
+            if (packed_size < size)
+            {
+                free(data[i]);
+                data[i] = packed;
+                members[i].size = packed_size;
+                members[i].flags |= ARCHIVE_MEMBER_LZ;
+            }
+            else
+                free(packed);
+        }
+        index_size += ARCHIVE_ENTRY_SIZE + strlen(name);
+    }
+
+    //member data follows the index in argument order
+    total = index_size;
+    for (i = 0; i < nfiles; i++)
+    {
+        members[i].offset = total;
+        total += members[i].size;
+    }
+    if (total > UINT32_MAX || (*payload = malloc(total)) == NULL)
+        goto out;
+
+    p = (unsigned char *)*payload;
+    write_le32(p, index_size);
+    write_le32(p + 4, nfiles);
+    p += ARCHIVE_HEAD_SIZE;
+    for (i = 0; i < nfiles; i++)
+    {
+        size_t len = strlen(members[i].name);
+
+        *p++ = len;
+        memcpy(p, members[i].name, len);
+        p += len;
+        write_le32(p, members[i].offset);
+        write_le32(p + 4, members[i].size);
+        write_le32(p + 8, members[i].raw_size);
+        write_le32(p + 12, members[i].flags);
+        p += ARCHIVE_ENTRY_SIZE - 1;
+    }
+    for (i = 0; i < nfiles; i++)
+        memcpy(*payload + members[i].offset, data[i], members[i].size);
+    *payload_size = total;
+    ret = e_success;
+
+out:
+    for (i = 0; data && i < nfiles; i++)
+        free(data[i]);
+    free(data);
+    free(members);
+    return ret;
+}
+
+/*Function to hide files argv[4]... in carrier argv[2], writing stego image argv[3]*/
+static Status create_archive(int argc, char *argv[], const StegoOptions *opts)
+{
+    EncodeInfo encInfo;
+    char *payload = NULL;
+    long payload_size;
+    Status ret;
+
+    if (argc < 5)
+    {
+        fprintf(stderr, "ERROR: archive needs a carrier, a stego image and at least one file\n");
+        return e_failure;
+    }
+    if (opts->patch)
+    {
+        fprintf(stderr, "ERROR: --in-place and --clone are not supported with an archive\n");
+        return e_failure;
+    }
+
+    memset(&encInfo, 0, sizeof(encInfo));
+    encInfo.opts = *opts;
+    if (build_archive(argv + 4, argc - 4, opts->compress, &payload, &payload_size) != e_success)
+        return e_failure;
+
+    //members are already compressed one by one, the payload is embedded as it is
+    encInfo.opts.compress = 0;
+    encInfo.src_image_fname = argv[2];
+    encInfo.stego_image_fname = argv[3];
+    encInfo.secret_buffer = payload;
+    encInfo.size_secret_file = payload_size;
+    encInfo.archive = 1;
+
+    ret = do_encoding(&encInfo);
+    if (opts->stats_json)
+        stats_print_json(stdout, "archive", argv[2], ret, &encInfo.stats);
+    PHASE_MSG(*opts, ret == e_success ? "Archived %d files in %s\n" : "Failed to archive %d files in %s\n", argc - 4, argv[3]);
+    free(payload);
+    return ret;
+}
+
+/*Function to open stego image fname and read its archive index*/
+static Status open_archive(DecodeInfo *decInfo, const char *fname, const StegoOptions *opts, ArchiveMember **members, uint32_t *count)
+{
+    unsigned char head[ARCHIVE_HEAD_SIZE], *index = NULL, *p;
+    uint32_t index_size, i;
+
+    memset(decInfo, 0, sizeof(*decInfo));
+    decInfo->opts = *opts;
+    decInfo->opts.quiet = 1;
+    decInfo->stego_image_fname = (char *)fname;
+    *members = NULL;
+
+    if (open_stego_image(decInfo) != e_success || decode_header_phases(decInfo) != e_success)
+        return e_failure;
+    if (!(decInfo->header_flags & FLAG_ARCHIVE))
+    {
+        fprintf(stderr, "ERROR: %s does not hold an archive\n", fname);
+        return e_failure;
+    }
+
+    //index size first, then the rest of the index in one go
+    if (decode_payload_range(decInfo, 0, ARCHIVE_HEAD_SIZE, (char *)head) != e_success)
+        return e_failure;
+    index_size = read_le32(head);
+    *count = read_le32(head + 4);
+    if (index_size < ARCHIVE_HEAD_SIZE || index_size > decInfo->secret_file_size ||
+        *count > (index_size - ARCHIVE_HEAD_SIZE) / (ARCHIVE_ENTRY_SIZE + 1))
+        goto bad;
+    index = malloc(index_size);
+    *members = calloc(*count ? *count : 1, sizeof(ArchiveMember));
+    if (index == NULL || *members == NULL ||
+        decode_payload_range(decInfo, 0, index_size, (char *)index) != e_success)
+        goto bad;
+
+    p = index + ARCHIVE_HEAD_SIZE;
+    for (i = 0; i < *count; i++)
+    {
+        ArchiveMember *m = &(*members)[i];
+        size_t len;
+
+        if (p + 1 > index + index_size)
+            goto bad;
+        len = *p++;
+        if (p + len + ARCHIVE_ENTRY_SIZE - 1 > index + index_size || !valid_member_name((const char *)p, len))
+            goto bad;
+        memcpy(m->name, p, len);
+        m->name[len] = '\0';
+        p += len;
+        m->offset = read_le32(p);
+        m->size = read_le32(p + 4);
+        m->raw_size = read_le32(p + 8);
+        m->flags = read_le32(p + 12);
+        p += ARCHIVE_ENTRY_SIZE - 1;
+
+        //members must lie inside the payload
+        if (m->offset < index_size || (long)m->offset + m->size > decInfo->secret_file_size)
+            goto bad;
+    }
+    free(index);
+    return e_success;
+
+bad:
+    fprintf(stderr, "ERROR: archive index of %s is damaged\n", fname);
+    free(index);
+    free(*members);
+    *members = NULL;
+    return e_failure;
+}
+
+/*Function to print the members of every archive in argv[2]...*/
+static Status list_archives(int argc, char *argv[], const StegoOptions *opts)
+{
+    Status ret = e_success;
+    int i;
+
+    for (i = 2; i < argc; i++)
+    {
+        DecodeInfo decInfo;
+        ArchiveMember *members;
+        uint32_t count, j;
+
+        if (open_archive(&decInfo, argv[i], opts, &members, &count) != e_success)
+            ret = e_failure;
+        else
+        {
+            printf("%s: %u member%s\n", argv[i], count, count == 1 ? "" : "s");
+            for (j = 0; j < count; j++)
+            {
+                printf("  %10u  %s", members[j].raw_size, members[j].name);
+                if (members[j].flags & ARCHIVE_MEMBER_LZ)
+                    printf(" (lz compressed to %u)", members[j].size);
+                printf("\n");
+            }
+        }
+        free(members);
+        Close_files(&decInfo);
+    }
+    return ret;
+}
+
+/*Function to write one member to fptr, reading only its carrier bytes*/
+static Status write_member(DecodeInfo *decInfo, const ArchiveMember *m, FILE *fptr)
+{
+    char *buf, *raw;
+    long done = 0;
+    Status ret = e_success;
+
+    //compressed member: stored bytes in memory, then inflated
+    if (m->flags & ARCHIVE_MEMBER_LZ)
+    {
+        buf = malloc(m->size ? m->size : 1);
+        raw = malloc(m->raw_size ? m->raw_size : 1);
+        if (buf == NULL || raw == NULL ||
+            decode_payload_range(decInfo, m->offset, m->size, buf) != e_success ||
+            lz_decompress(buf, m->size, raw, m->raw_size) != e_success ||
+            fwrite(raw, 1, m->raw_size, fptr) != m->raw_size)
+            ret = e_failure;
+        free(buf);
+        free(raw);
+        return ret;
+    }
+
+    buf = malloc(ARCHIVE_COPY_SIZE);
+    if (buf == NULL)
+        return e_failure;
+    while (ret == e_success && done < (long)m->size)
+    {
+        long count = m->size - done < ARCHIVE_COPY_SIZE ? m->size - done : ARCHIVE_COPY_SIZE;
+
+        if (decode_payload_range(decInfo, m->offset + done, count, buf) != e_success ||
+            fwrite(buf, 1, count, fptr) != (size_t)count)
+            ret = e_failure;
+        done += count;
+    }
+    free(buf);
+    return ret;
+}
+
+/*Function to extract member opts->member of archive argv[2] into argv[3] or a file of its name*/
+static Status extract_member(int argc, char *argv[], const StegoOptions *opts)
+{
+    DecodeInfo decInfo;
+    ArchiveMember *members;
+    uint32_t count, i;
+    const char *out = argc > 3 ? argv[3] : opts->member;
+    FILE *fptr;
+    Status ret = e_failure;
+
+    if (open_archive(&decInfo, argv[2], opts, &members, &count) != e_success)
+    {
+        free(members);
+        Close_files(&decInfo);
+        return e_failure;
+    }
+
+    for (i = 0; i < count && strcmp(members[i].name, opts->member) != 0; i++)
+        ;
+    if (i == count)
+        fprintf(stderr, "ERROR: %s has no member %s\n", argv[2], opts->member);
+    else if ((fptr = fopen(out, "w")) == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", out);
+    }
+    else
+    {
+        ret = write_member(&decInfo, &members[i], fptr);
+        if (fclose(fptr) != 0)
+            ret = e_failure;
+        PHASE_MSG(*opts, ret == e_success ? "Extracted %s into %s\n" : "Failed to extract %s into %s\n", opts->member, out);
+    }
+
+    free(members);
+    Close_files(&decInfo);
+    return ret;
+}
+
+/*Function to create, list or extract as the options say*/
+Status run_archive(int argc, char *argv[], const StegoOptions *opts)
+{
+    if (opts->list)
+        return list_archives(argc, argv, opts);
+    if (opts->member)
+        return extract_member(argc, argv, opts);
+    return create_archive(argc, argv, opts);
+}
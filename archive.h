@@ -0,0 +1,50 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Archive mode: several files in one carrier
+ * The payload starts with an index, member data follows it. All
+ * numbers are 32 bit little endian:
+ *   index size (bytes, these 8 included), member count
+ *   per member: name length (1 byte), name, offset, stored size,
+ *               raw size, flags
+ * Offsets are from the start of the payload. A member is read by
+ * decoding the index and then only the carrier bytes of that member,
+ * with --key and --scatter too since both are addressed by offset.
+ * With --compress each member is lz compressed on its own, so the
+ * random access is kept.
+ *
+ *   ./a.out -a carrier.bmp stego.bmp file...          create
+ *   ./a.out -a --list stego.bmp...                   list members
+ *   ./a.out -a --extract=NAME stego.bmp [output]      extract one member
+ */
+
+/* Bytes in front of the index entries */
+#define ARCHIVE_HEAD_SIZE 8
+
+/* Index bytes of a member besides its name */
+#define ARCHIVE_ENTRY_SIZE 17
+
+/* Longest member name, path is dropped */
+#define ARCHIVE_MAX_NAME 255
+
+/* Member flags: stored bytes are an lz stream of raw size bytes */
+#define ARCHIVE_MEMBER_LZ 0x00000001
+
+/* One index entry */
+typedef struct _ArchiveMember
+{
+    char name[ARCHIVE_MAX_NAME + 1];
+    uint32_t offset;
+    uint32_t size;          // stored bytes
+    uint32_t raw_size;      // bytes of the file
+    uint32_t flags;
+} ArchiveMember;
+
+/* Create, list or extract as selected by the options, argv as on the command line */
+Status run_archive(int argc, char *argv[], const StegoOptions *opts);
+
+#endif
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+#include "threadpool.h"
+#include "common.h"
+#include "types.h"
+
+/* Task argument, job plus options shared by all jobs */
+typedef struct
+{
+    BatchJob *job;
+    const StegoOptions *opts;
+} BatchTask;
+
+/*Function to get monotonic time in seconds*/
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*Function to run one job, every job has its own EncodeInfo/DecodeInfo*/
+static void run_job(void *arg)
+{
+    BatchTask *task = arg;
+    BatchJob *job = task->job;
+    double start = now_seconds();
+
+    job->status = e_failure;
+    if (job->type == e_encode)
+    {
+        EncodeInfo encInfo;
+
+        memset(&encInfo, 0, sizeof(encInfo));
+        encInfo.opts = *task->opts;
+        if (read_and_validate_encode_args(job->args, &encInfo) == e_success)
+            job->status = do_encoding(&encInfo);
+        job->bytes = encInfo.image_file_size;
+        job->stats = encInfo.stats;
+    }
+    else
+    {
+        DecodeInfo decInfo;
+
+        memset(&decInfo, 0, sizeof(decInfo));
+        decInfo.opts = *task->opts;
+        if (read_and_validate_decode_args(job->args, &decInfo) == e_success)
+            job->status = do_decoding(&decInfo);
+        job->bytes = decInfo.stego_image_size;
+        job->stats = decInfo.stats;
+    }
+    job->seconds = now_seconds() - start;
+}
+
+/*Function to parse one manifest line into a job*/
+static Status parse_job(char *line, BatchJob *job)
+{
+    char *save = NULL;
+    char *tok = strtok_r(line, " \t\r\n", &save);
+    int n = 2;
+
+    if (tok == NULL)
+        return e_failure;
+    if (strcmp(tok, "e") == 0)
+        job->type = e_encode;
+    else if (strcmp(tok, "d") == 0)
+        job->type = e_decode;
+    else
+        return e_failure;
+
+    //same layout as the command line so the arg validators can be reused
+    job->args[0] = strdup("a.out");
+    job->args[1] = strdup(job->type == e_encode ? "-e" : "-d");
+    while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+    {
+        if (n == BATCH_MAX_ARGS + 1)
+            return e_failure;
+        job->args[n++] = strdup(tok);
+    }
+    job->args[n] = NULL;
+
+    //every job names its output, the single file defaults would be shared by workers
+    if (n < (job->type == e_encode ? 5 : 4))
+        return e_failure;
+    return e_success;
+}
+
+/*Function to read manifest into a job array*/
+static Status read_manifest(const char *manifest, BatchJob **jobs, int *njobs)
+{
+    FILE *fptr = fopen(manifest, "r");
+    char *line = NULL;
+    size_t line_size = 0;
+    int cap = 0, lineno = 0;
+
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", manifest);
+        return e_failure;
+    }
+
+    *jobs = NULL;
+    *njobs = 0;
+    while (getline(&line, &line_size, fptr) != -1)
+    {
+        char *p = line;
+
+        lineno++;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+            continue;
+
+        if (*njobs == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            BatchJob *grown = realloc(*jobs, cap * sizeof(BatchJob));
+            if (grown == NULL)
+            {
+                free(line);
+                fclose(fptr);
+                return e_failure;
+            }
+            *jobs = grown;
+        }
+
+        BatchJob *job = &(*jobs)[*njobs];
+        memset(job, 0, sizeof(*job));
+        job->line = lineno;
+        if (parse_job(p, job) != e_success)
+        {
+            fprintf(stderr, "ERROR: %s:%d: invalid job\n", manifest, lineno);
+            free(line);
+            fclose(fptr);
+            (*njobs)++;
+            return e_failure;
+        }
+        (*njobs)++;
+    }
+    free(line);
+    fclose(fptr);
+    return e_success;
+}
+
+/*Function to free job array*/
+static void free_jobs(BatchJob *jobs, int njobs)
+{
+    int i, j;
+
+    for(i = 0 ; i < njobs ; i++)
+    {
+        for(j = 0 ; j < BATCH_MAX_ARGS + 2 ; j++)
+            free(jobs[i].args[j]);
+    }
+    free(jobs);
+}
+
+/*Function to read manifest and run every job on the thread pool*/
+Status run_batch(const char *manifest, StegoOptions *opts)
+{
+    BatchJob *jobs = NULL;
+    BatchTask *tasks;
+    ThreadPool *pool;
+    StegoOptions job_opts = *opts;
+    int njobs = 0, nthreads, failed = 0, i;
+    long total_bytes = 0;
+    double start, elapsed;
+
+    if (read_manifest(manifest, &jobs, &njobs) != e_success)
+    {
+        free_jobs(jobs, njobs);
+        return e_failure;
+    }
+
+    //jobs run side by side, each one on a single thread and without phase messages
+    nthreads = opts->threads > 1 ? opts->threads : get_cpu_count();
+    job_opts.threads = 1;
+    job_opts.quiet = 1;
+
+    tasks = malloc((njobs ? njobs : 1) * sizeof(BatchTask));
+    pool = threadpool_create(nthreads);
+    if (tasks == NULL || pool == NULL)
+    {
+        free(tasks);
+        threadpool_destroy(pool);
+        free_jobs(jobs, njobs);
+        return e_failure;
+    }
+
+    start = now_seconds();
+    for(i = 0 ; i < njobs ; i++)
+    {
+        tasks[i].job = &jobs[i];
+        tasks[i].opts = &job_opts;
+        if (threadpool_submit(pool, run_job, &tasks[i]) != e_success)
+            run_job(&tasks[i]);
+    }
+    threadpool_wait(pool);
+    elapsed = now_seconds() - start;
+    threadpool_destroy(pool);
+
+    //per job status in manifest order
+    for(i = 0 ; i < njobs ; i++)
+    {
+        BatchJob *job = &jobs[i];
+
+        if (opts->stats_json)
+            stats_print_json(stdout, job->type == e_encode ? "encode" : "decode", job->args[2], job->status, &job->stats);
+        PHASE_MSG(*opts, "job %d (line %d): %s %s %s (%.2f MB, %.3f ms)\n", i + 1, job->line,
+               job->type == e_encode ? "encode" : "decode", job->args[2],
+               job->status == e_success ? "ok" : "FAILED",
+               job->bytes / 1e6, job->seconds * 1e3);
+        if (job->status != e_success)
+            failed++;
+        else
+            total_bytes += job->bytes;
+    }
+    PHASE_MSG(*opts, "Batch: %d jobs, %d failed, %.2f MB in %.3f s on %d threads, %.2f MB/s\n",
+           njobs, failed, total_bytes / 1e6, elapsed, nthreads,
+           elapsed > 0 ? total_bytes / 1e6 / elapsed : 0.0);
+
+    free(tasks);
+    free_jobs(jobs, njobs);
+    return failed ? e_failure : e_success;
+}
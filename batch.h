@@ -0,0 +1,35 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "types.h" // Contains user defined types
+#include "stats.h"
+
+/*
+ * Batch mode: many encode/decode jobs in one process
+ * Manifest has one job per line, blank lines and lines
+ * starting with '#' are skipped:
+ *   e <carrier.bmp> <secret> <stego.bmp>
+ *   d <stego.bmp> <output>
+ * The output is required, jobs run in parallel and must not share
+ * the stego.bmp/decode.txt defaults.
+ */
+
+/* Max jobs in one manifest line: operation + 3 files */
+#define BATCH_MAX_ARGS 4
+
+/* One job read from the manifest */
+typedef struct _BatchJob
+{
+    OperationType type;
+    char *args[BATCH_MAX_ARGS + 2];     // argv layout: "a.out", "-e", files..., NULL
+    int line;
+    Status status;
+    long bytes;             // image bytes processed
+    double seconds;
+    StegoStats stats;
+} BatchJob;
+
+/* Read manifest and run every job on the thread pool */
+Status run_batch(const char *manifest, StegoOptions *opts);
+
+#endif
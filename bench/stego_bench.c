@@ -0,0 +1,426 @@
+/*Documentation
+Description: Benchmark for encode/decode phases
+Generates synthetic 24 bit BMP carriers and random payloads, runs every
+encode and decode phase on its own and reports time per phase.
+
+Build (from the repository root):
+gcc -O2 -I. bench/stego_bench.c encode.c decode.c lsb.c threadpool.c stats.c bmp.c pnm.c carrier.c lz.c crc32c.c chacha20.c scatter.c ring.c stego.c -o stego_bench
+
+Usage:
+./stego_bench [--sizes=1,4,16,100] [--payload=0.01,0.1,0.5]
+              [--paths=scalar,simd,mmap,threads,mmap+threads]
+              [--threads=N] [--reps=N] [--format=csv|json] [--dir=/tmp]
+sizes are in mega pixels, payload is the fraction of the image capacity.
+Output goes to stdout, one record per (image, payload, path, op, phase).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "encode.h"
+#include "decode.h"
+#include "lsb.h"
+#include "threadpool.h"
+#include "common.h"
+#include "types.h"
+
+#define MAX_LIST 16
+
+/* Path under test: kernel plus encode/decode options */
+typedef struct
+{
+    const char *name;
+    const char *kernel;
+    int use_mmap;
+    int threaded;
+} BenchPath;
+
+static const BenchPath all_paths[] =
+{
+    { "scalar", "scalar", 0, 0 },
+    { "simd", "auto", 0, 0 },
+    { "mmap", "auto", 1, 0 },
+    { "threads", "auto", 0, 1 },
+    { "mmap+threads", "auto", 1, 1 },
+};
+
+/* One timed phase */
+typedef struct
+{
+    const char *name;
+    long bytes;         // carrier bytes the phase touches
+    double ns;
+} PhaseTime;
+
+/* Benchmark settings */
+typedef struct
+{
+    double sizes[MAX_LIST];
+    int nsizes;
+    double payloads[MAX_LIST];
+    int npayloads;
+    const BenchPath *paths[MAX_LIST];
+    int npaths;
+    int threads;
+    int reps;
+    int json;
+    const char *dir;
+} BenchConfig;
+
+static int records;
+
+/*Function to get monotonic time in ns*/
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*Function to parse comma separated numbers*/
+static int parse_list(const char *str, double *list)
+{
+    int n = 0;
+
+    while (*str && n < MAX_LIST)
+    {
+        char *end;
+        list[n++] = strtod(str, &end);
+        if (end == str)
+            return -1;
+        str = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+/*Function to parse comma separated path names*/
+static int parse_paths(const char *str, const BenchPath **paths)
+{
+    char buf[256];
+    char *save = NULL, *tok;
+    int n = 0;
+    uint i;
+
+    snprintf(buf, sizeof(buf), "%s", str);
+    for (tok = strtok_r(buf, ",", &save); tok && n < MAX_LIST; tok = strtok_r(NULL, ",", &save))
+    {
+        for (i = 0; i < sizeof(all_paths) / sizeof(all_paths[0]); i++)
+        {
+            if (strcmp(tok, all_paths[i].name) == 0)
+                break;
+        }
+        if (i == sizeof(all_paths) / sizeof(all_paths[0]))
+            return -1;
+        paths[n++] = &all_paths[i];
+    }
+    return n;
+}
+
+/*Function to write a synthetic 24 bit bmp of about mp mega pixels*/
+static Status write_bmp(const char *fname, double mp, long *image_size)
+{
+    uint width = 4096;
+    uint height = (uint)(mp * 1e6 / width);
+    uint data_size;
+    unsigned char header[BMP_HEADER_SIZE] = { 'B', 'M' };
+    uint value;
+    char *row;
+    FILE *fptr;
+    uint y, x;
+
+    if (height == 0)
+        height = 1;
+    data_size = width * height * 3;
+
+    //file header and 40 byte info header, little endian fields
+    value = BMP_HEADER_SIZE + data_size; memcpy(header + 2, &value, 4);
+    value = BMP_HEADER_SIZE; memcpy(header + 10, &value, 4);
+    value = 40; memcpy(header + 14, &value, 4);
+    memcpy(header + 18, &width, 4);
+    memcpy(header + 22, &height, 4);
+    header[26] = 1;
+    header[28] = 24;
+    memcpy(header + 34, &data_size, 4);
+
+    fptr = fopen(fname, "w");
+    if (fptr == NULL)
+        return e_failure;
+    fwrite(header, BMP_HEADER_SIZE, 1, fptr);
+
+    //gradient with noise, width * 3 is a multiple of 4 so rows have no padding
+    row = malloc(width * 3);
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width * 3; x++)
+            row[x] = (char)(x + y + (rand() & 7));
+        fwrite(row, width * 3, 1, fptr);
+    }
+    free(row);
+    fclose(fptr);
+    *image_size = BMP_HEADER_SIZE + (long)data_size;
+    return e_success;
+}
+
+/*Function to write size random bytes*/
+static Status write_payload(const char *fname, long size)
+{
+    FILE *fptr = fopen(fname, "w");
+    char buf[65536];
+    long done = 0;
+
+    if (fptr == NULL)
+        return e_failure;
+    while (done < size)
+    {
+        long n = size - done < (long)sizeof(buf) ? size - done : (long)sizeof(buf);
+        long i;
+        for (i = 0; i < n; i++)
+            buf[i] = rand();
+        fwrite(buf, n, 1, fptr);
+        done += n;
+    }
+    fclose(fptr);
+    return e_success;
+}
+
+/*Function to print one result record*/
+static void report(const BenchConfig *cfg, double mp, long image_size, long payload, const char *path,
+                   const char *op, const PhaseTime *phase)
+{
+    double mbps = phase->ns > 0 ? phase->bytes / 1e6 / (phase->ns / 1e9) : 0;
+    double ns_per_byte = phase->bytes > 0 ? phase->ns / phase->bytes : 0;
+
+    if (cfg->json)
+    {
+        printf("%s  {\"mp\": %.1f, \"image_bytes\": %ld, \"payload_bytes\": %ld, \"path\": \"%s\", "
+               "\"kernel\": \"%s\", \"op\": \"%s\", \"phase\": \"%s\", \"bytes\": %ld, \"ns\": %.0f, "
+               "\"mb_per_s\": %.2f, \"ns_per_byte\": %.4f}",
+               records ? ",\n" : "", mp, image_size, payload, path, lsb_kernel_name(), op,
+               phase->name, phase->bytes, phase->ns, mbps, ns_per_byte);
+    }
+    else
+    {
+        printf("%.1f,%ld,%ld,%s,%s,%s,%s,%ld,%.0f,%.2f,%.4f\n", mp, image_size, payload, path,
+               lsb_kernel_name(), op, phase->name, phase->bytes, phase->ns, mbps, ns_per_byte);
+    }
+    records++;
+}
+
+/*Macro to time one phase, stops the run on failure*/
+#define TIME_PHASE(ph, call) do { \
+        double t0 = now_ns(); \
+        if ((call) != e_success) { fprintf(stderr, "phase %s failed\n", (ph)->name); ok = e_failure; } \
+        (ph)->ns += now_ns() - t0; \
+    } while (0)
+
+/*Function to run encode phases once, adding time per phase*/
+static Status bench_encode(char *src, char *secret, char *stego, StegoOptions *opts, PhaseTime *ph)
+{
+    EncodeInfo encInfo;
+    Status ok = e_success;
+    int extn_size;
+
+    memset(&encInfo, 0, sizeof(encInfo));
+    encInfo.opts = *opts;
+    encInfo.src_image_fname = src;
+    encInfo.secret_fname = secret;
+    encInfo.stego_image_fname = stego;
+    get_secret_file_extn(secret, encInfo.extn_secret_file);
+    extn_size = strlen(encInfo.extn_secret_file);
+
+    //opening and capacity check are setup, not timed
+    if (open_files(&encInfo) != e_success || check_capacity(&encInfo) != e_success)
+    {
+        close_files(&encInfo);
+        return e_failure;
+    }
+
+    TIME_PHASE(&ph[0], copy_bmp_header(&encInfo));
+    TIME_PHASE(&ph[1], encode_magic_string(MAGIC_STRING, &encInfo));
+    TIME_PHASE(&ph[2], encode_secret_file_extn_size(extn_size, &encInfo));
+    TIME_PHASE(&ph[3], encode_secret_file_extn(encInfo.extn_secret_file, &encInfo));
+    TIME_PHASE(&ph[4], encode_secret_file_size(encInfo.size_secret_file, &encInfo));
+    TIME_PHASE(&ph[5], encode_secret_file_data(&encInfo));
+    TIME_PHASE(&ph[6], copy_remaining_img_data(&encInfo));
+
+    //flushing and unmapping is part of getting the image out
+    double t0 = now_ns();
+    close_files(&encInfo);
+    ph[6].ns += now_ns() - t0;
+    return ok;
+}
+
+/*Function to run decode phases once, adding time per phase*/
+static Status bench_decode(char *stego, char *output, StegoOptions *opts, PhaseTime *ph)
+{
+    DecodeInfo decInfo;
+    Status ok = e_success;
+
+    memset(&decInfo, 0, sizeof(decInfo));
+    decInfo.opts = *opts;
+    decInfo.stego_image_fname = stego;
+    decInfo.decode_fname = output;
+
+    if (Open_files(&decInfo) != e_success)
+    {
+        Close_files(&decInfo);
+        return e_failure;
+    }
+
+    TIME_PHASE(&ph[0], decode_magic_string(&decInfo));
+    TIME_PHASE(&ph[1], decode_secret_file_extn_size(&decInfo));
+    TIME_PHASE(&ph[2], decode_secret_file_extn(&decInfo));
+    TIME_PHASE(&ph[3], decode_secret_file_size(&decInfo));
+    TIME_PHASE(&ph[4], decode_secret_file_data(&decInfo));
+
+    double t0 = now_ns();
+    Close_files(&decInfo);
+    ph[4].ns += now_ns() - t0;
+    return ok;
+}
+
+/*Function to benchmark one image and payload on every path*/
+static Status bench_case(const BenchConfig *cfg, double mp, double fraction)
+{
+    char src[512], secret[512], stego[512], output[512];
+    long image_size, payload, header, extn_size = strlen(".bin");
+    int p, r, i;
+    Status ret = e_success;
+
+    snprintf(src, sizeof(src), "%s/stego_bench_%d.bmp", cfg->dir, getpid());
+    snprintf(secret, sizeof(secret), "%s/stego_bench_%d.bin", cfg->dir, getpid());
+    snprintf(stego, sizeof(stego), "%s/stego_bench_%d_out.bmp", cfg->dir, getpid());
+    snprintf(output, sizeof(output), "%s/stego_bench_%d_out.bin", cfg->dir, getpid());
+
+    if (write_bmp(src, mp, &image_size) != e_success)
+        return e_failure;
+
+    //magic, extn size, extn and file size come before the data
+    header = strlen(MAGIC_STRING) + 4 + extn_size + 4;
+    payload = (long)((image_size - BMP_HEADER_SIZE) / 8 * fraction) - header - 1;
+    if (payload < 1)
+        payload = 1;
+    if (write_payload(secret, payload) != e_success)
+        return e_failure;
+
+    for (p = 0; p < cfg->npaths && ret == e_success; p++)
+    {
+        const BenchPath *path = cfg->paths[p];
+        StegoOptions opts;
+        PhaseTime enc[7] = {
+            { "header_copy", BMP_HEADER_SIZE, 0 }, { "magic_string", strlen(MAGIC_STRING) * 8, 0 },
+            { "extn_size", 32, 0 }, { "extn", extn_size * 8, 0 }, { "file_size", 32, 0 },
+            { "data", payload * 8, 0 }, { "tail_copy", 0, 0 } };
+        PhaseTime dec[5] = {
+            { "magic_string", strlen(MAGIC_STRING) * 8, 0 }, { "extn_size", 32, 0 }, { "extn", extn_size * 8, 0 },
+            { "file_size", 32, 0 }, { "data", payload * 8, 0 } };
+
+        enc[6].bytes = image_size - BMP_HEADER_SIZE - (header + payload) * 8;
+
+        memset(&opts, 0, sizeof(opts));
+        opts.quiet = 1;
+        opts.use_mmap = path->use_mmap;
+        opts.threads = path->threaded ? cfg->threads : 1;
+        if (lsb_select_kernel(path->kernel) != e_success)
+        {
+            fprintf(stderr, "kernel %s not supported, skipping %s\n", path->kernel, path->name);
+            continue;
+        }
+
+        for (r = 0; r < cfg->reps && ret == e_success; r++)
+        {
+            if (bench_encode(src, secret, stego, &opts, enc) != e_success ||
+                bench_decode(stego, output, &opts, dec) != e_success)
+                ret = e_failure;
+        }
+        if (ret != e_success)
+            break;
+
+        for (i = 0; i < 7; i++)
+        {
+            enc[i].ns /= cfg->reps;
+            report(cfg, mp, image_size, payload, path->name, "encode", &enc[i]);
+        }
+        for (i = 0; i < 5; i++)
+        {
+            dec[i].ns /= cfg->reps;
+            report(cfg, mp, image_size, payload, path->name, "decode", &dec[i]);
+        }
+    }
+
+    unlink(src);
+    unlink(secret);
+    unlink(stego);
+    unlink(output);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig cfg;
+    int i, s, p;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.nsizes = parse_list("1,4,16,100", cfg.sizes);
+    cfg.npayloads = parse_list("0.01,0.1,0.5", cfg.payloads);
+    cfg.npaths = parse_paths("scalar,simd,mmap,threads,mmap+threads", cfg.paths);
+    cfg.threads = get_cpu_count();
+    cfg.reps = 3;
+    cfg.dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--sizes=", 8) == 0)
+            cfg.nsizes = parse_list(argv[i] + 8, cfg.sizes);
+        else if (strncmp(argv[i], "--payload=", 10) == 0)
+            cfg.npayloads = parse_list(argv[i] + 10, cfg.payloads);
+        else if (strncmp(argv[i], "--paths=", 8) == 0)
+            cfg.npaths = parse_paths(argv[i] + 8, cfg.paths);
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+            cfg.threads = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--reps=", 7) == 0)
+            cfg.reps = atoi(argv[i] + 7);
+        else if (strcmp(argv[i], "--format=json") == 0)
+            cfg.json = 1;
+        else if (strcmp(argv[i], "--format=csv") == 0)
+            cfg.json = 0;
+        else if (strncmp(argv[i], "--dir=", 6) == 0)
+            cfg.dir = argv[i] + 6;
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (cfg.nsizes <= 0 || cfg.npayloads <= 0 || cfg.npaths <= 0 || cfg.reps < 1 || cfg.threads < 1)
+    {
+        fprintf(stderr, "Invalid sizes, payload, paths, reps or threads\n");
+        return 1;
+    }
+
+    srand(1);
+    if (cfg.json)
+        printf("[\n");
+    else
+        printf("mp,image_bytes,payload_bytes,path,kernel,op,phase,bytes,ns,mb_per_s,ns_per_byte\n");
+
+    for (s = 0; s < cfg.nsizes; s++)
+    {
+        for (p = 0; p < cfg.npayloads; p++)
+        {
+            if (bench_case(&cfg, cfg.sizes[s], cfg.payloads[p]) != e_success)
+            {
+                fprintf(stderr, "Benchmark failed for %.1f MP, payload %.3f\n", cfg.sizes[s], cfg.payloads[p]);
+                return 1;
+            }
+        }
+    }
+
+    if (cfg.json)
+        printf("\n]\n");
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "carrier.h"
+#include "common.h"
+#include "types.h"
+
+/* biCompression values we can embed into */
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+
+/*Function to read little endian 32 bit value*/
+static uint32_t read_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*Function to build layout from bmp header*/
+Status bmp_parse_layout(const unsigned char *header, long header_len, long file_size, CarrierLayout *layout)
+{
+    uint32_t info_size, compression;
+    int32_t width, height;
+    int bpp;
+
+    memset(layout, 0, sizeof(*layout));
+    if (header_len < BMP_HEADER_SIZE || header[0] != 'B' || header[1] != 'M')
+        return e_failure;
+    layout->format = "bmp";
+
+    layout->data_offset = read_le32(header + 10);
+    info_size = read_le32(header + 14);
+    width = (int32_t)read_le32(header + 18);
+    height = (int32_t)read_le32(header + 22);
+    bpp = header[28] | (header[29] << 8);
+    compression = read_le32(header + 30);
+
+    //negative height means rows are stored top-down
+    if (info_size < 40 || width <= 0 || height == 0 || height == INT32_MIN)
+        return e_failure;
+    layout->rows = height < 0 ? -(long)height : height;
+
+    if (bpp == 24 && compression == BI_RGB)
+        layout->pixel_stride = 3;
+    else if (bpp == 32 && compression == BI_RGB)
+    {
+        //fourth byte of every pixel is alpha or unused
+        layout->pixel_stride = 4;
+    }
+    else if (bpp == 32 && compression == BI_BITFIELDS && header_len >= BMP_PARSE_SIZE - 4)
+    {
+        //colour masks follow the 40 byte info header, in v4/v5 headers too
+        uint32_t rgb = read_le32(header + 54) | read_le32(header + 58) | read_le32(header + 62);
+
+        layout->pixel_stride = 4;
+        if (rgb == 0xFFFFFF00u)
+            layout->pixel_skip = 1;
+        else if (rgb != 0x00FFFFFFu)
+            return e_failure;
+    }
+    else
+        return e_failure;
+
+    //rows are padded to a multiple of 4 bytes
+    layout->row_stride = ((long)width * bpp + 31) / 32 * 4;
+    layout->row_bytes = (long)width * 3;
+    layout->capacity = layout->row_bytes * layout->rows;
+    layout->contiguous = layout->pixel_stride == 3 && layout->row_stride == layout->row_bytes;
+
+    if (layout->data_offset < 14 + (long)info_size ||
+        layout->data_offset + layout->rows * layout->row_stride > file_size)
+        return e_failure;
+    return e_success;
+}
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include "carrier.h"
+#include "lsb.h"
+#include "common.h"
+#include "types.h"
+
+/* Payload bytes embedded per gather/scatter round in split layouts */
+#define SPAN_BLOCK 4096
+
+/* Moves len logical bytes from pos between image and a packed buffer */
+typedef void (*CarrierCopy)(const CarrierLayout *layout, unsigned char *image, long base, long pos, unsigned char *packed, long len, int to_image);
+
+/* Formats tried in turn on the header bytes */
+static Status (*const carrier_parsers[])(const unsigned char *, long, long, CarrierLayout *) =
+{
+    bmp_parse_layout,
+    pnm_parse_layout,
+};
+
+/* File name suffixes of carrier images and the stego name used when none is given */
+static const struct
+{
+    const char *suffix;
+    const char *stego_name;
+} carrier_names[] =
+{
+    { ".bmp", "stego.bmp" },
+    { ".ppm", "stego.ppm" },
+    { ".pgm", "stego.pgm" },
+    { ".pnm", "stego.pnm" },
+};
+
+/*Function to embed into one span from data_offset*/
+static void embed_contiguous(const CarrierLayout *layout, char *buf, long base, long pos, const char *data, long n, int bits)
+{
+    lsb_embed_bytes_k(buf + (layout->data_offset + pos - base), data, n, bits);
+}
+
+/*Function to extract from one span from data_offset*/
+static void extract_contiguous(const CarrierLayout *layout, const unsigned char *buf, long base, long pos, char *data, long n, int bits)
+{
+    lsb_extract_bytes_k(buf + (layout->data_offset + pos - base), data, n, bits);
+}
+
+/*Function to move logical bytes of padded rows, each row is one span*/
+static void copy_rows(const CarrierLayout *layout, unsigned char *image, long base, long pos, unsigned char *packed, long len, int to_image)
+{
+    long row = pos / layout->row_bytes;
+    long col = pos % layout->row_bytes;
+
+    while (len > 0)
+    {
+        unsigned char *line = image + (layout->data_offset + row * layout->row_stride - base);
+        long n = layout->row_bytes - col < len ? layout->row_bytes - col : len;
+
+        if (to_image)
+            memcpy(line + col, packed, n);
+        else
+            memcpy(packed, line + col, n);
+        packed += n;
+        len -= n;
+        row++;
+        col = 0;
+    }
+}
+
+/*Function to move logical bytes of pixels with alpha, spans of 3 bytes*/
+static void copy_pixels(const CarrierLayout *layout, unsigned char *image, long base, long pos, unsigned char *packed, long len, int to_image)
+{
+    long row = pos / layout->row_bytes;
+    long col = pos % layout->row_bytes;
+
+    while (len > 0)
+    {
+        unsigned char *line = image + (layout->data_offset + row * layout->row_stride - base);
+        long n = layout->row_bytes - col < len ? layout->row_bytes - col : len;
+        long left = n;
+        unsigned char *px = line + col / 3 * layout->pixel_stride + layout->pixel_skip;
+        int b = col % 3;
+
+        //partial pixel at the start
+        for ( ; b && b < 3 && left > 0; b++, left--)
+        {
+            if (to_image)
+                px[b] = *packed++;
+            else
+                *packed++ = px[b];
+        }
+        if (b == 3)
+            px += layout->pixel_stride;
+
+        //whole pixels
+        for ( ; left >= 3; left -= 3, px += layout->pixel_stride, packed += 3)
+        {
+            if (to_image)
+                memcpy(px, packed, 3);
+            else
+                memcpy(packed, px, 3);
+        }
+
+        //partial pixel at the end
+        for (b = 0; left > 0; b++, left--)
+        {
+            if (to_image)
+                px[b] = *packed++;
+            else
+                *packed++ = px[b];
+        }
+        len -= n;
+        row++;
+        col = 0;
+    }
+}
+
+/*Function to embed through a packed copy: gather, embed, scatter back*/
+static void embed_packed(const CarrierLayout *layout, CarrierCopy copy, char *buf, long base, long pos, const char *data, long n, int bits)
+{
+    long stride = 8 / bits;
+    unsigned char packed[SPAN_BLOCK * 8];
+
+    while (n > 0)
+    {
+        long count = n < SPAN_BLOCK ? n : SPAN_BLOCK;
+
+        copy(layout, (unsigned char *)buf, base, pos, packed, count * stride, 0);
+        lsb_embed_bytes_k((char *)packed, data, count, bits);
+        copy(layout, (unsigned char *)buf, base, pos, packed, count * stride, 1);
+        pos += count * stride;
+        data += count;
+        n -= count;
+    }
+}
+
+/*Function to extract through a packed copy*/
+static void extract_packed(const CarrierLayout *layout, CarrierCopy copy, const unsigned char *buf, long base, long pos, char *data, long n, int bits)
+{
+    long stride = 8 / bits;
+    unsigned char packed[SPAN_BLOCK * 8];
+
+    while (n > 0)
+    {
+        long count = n < SPAN_BLOCK ? n : SPAN_BLOCK;
+
+        copy(layout, (unsigned char *)buf, base, pos, packed, count * stride, 0);
+        lsb_extract_bytes_k(packed, data, count, bits);
+        pos += count * stride;
+        data += count;
+        n -= count;
+    }
+}
+
+/*Function to embed into padded rows, in place when the range stays in one row*/
+static void embed_rows(const CarrierLayout *layout, char *buf, long base, long pos, const char *data, long n, int bits)
+{
+    if (pos / layout->row_bytes == (pos + n * (8 / bits) - 1) / layout->row_bytes)
+        lsb_embed_bytes_k(buf + (carrier_phys_offset(layout, pos) - base), data, n, bits);
+    else
+        embed_packed(layout, copy_rows, buf, base, pos, data, n, bits);
+}
+
+/*Function to extract from padded rows*/
+static void extract_rows(const CarrierLayout *layout, const unsigned char *buf, long base, long pos, char *data, long n, int bits)
+{
+    if (pos / layout->row_bytes == (pos + n * (8 / bits) - 1) / layout->row_bytes)
+        lsb_extract_bytes_k(buf + (carrier_phys_offset(layout, pos) - base), data, n, bits);
+    else
+        extract_packed(layout, copy_rows, buf, base, pos, data, n, bits);
+}
+
+/*Function to embed into pixels with alpha, a payload byte always spans pixels*/
+static void embed_pixels(const CarrierLayout *layout, char *buf, long base, long pos, const char *data, long n, int bits)
+{
+    embed_packed(layout, copy_pixels, buf, base, pos, data, n, bits);
+}
+
+/*Function to extract from pixels with alpha*/
+static void extract_pixels(const CarrierLayout *layout, const unsigned char *buf, long base, long pos, char *data, long n, int bits)
+{
+    extract_packed(layout, copy_pixels, buf, base, pos, data, n, bits);
+}
+
+static const CarrierKernel contiguous_kernel = { embed_contiguous, extract_contiguous };
+static const CarrierKernel rows_kernel = { embed_rows, extract_rows };
+static const CarrierKernel pixels_kernel = { embed_pixels, extract_pixels };
+
+/*Function to pick the kernel matching the layout*/
+static void carrier_set_kernel(CarrierLayout *layout)
+{
+    if (layout->contiguous)
+        layout->kernel = &contiguous_kernel;
+    else if (layout->pixel_stride == 4)
+        layout->kernel = &pixels_kernel;
+    else
+        layout->kernel = &rows_kernel;
+}
+
+/*Function to build layout from the header of any known format*/
+Status carrier_parse_layout(const unsigned char *header, long header_len, long file_size, CarrierLayout *layout)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(carrier_parsers) / sizeof(carrier_parsers[0]); i++)
+    {
+        if (carrier_parsers[i](header, header_len, file_size, layout) == e_success)
+        {
+            carrier_set_kernel(layout);
+            return e_success;
+        }
+    }
+    return e_failure;
+}
+
+/*Function to get stego image name for a carrier image name*/
+const char *carrier_stego_name(const char *fname)
+{
+    const char *dot = strrchr(fname, '.');
+    size_t i;
+
+    for (i = 0; dot != NULL && i < sizeof(carrier_names) / sizeof(carrier_names[0]); i++)
+    {
+        if (strcasecmp(dot, carrier_names[i].suffix) == 0)
+            return carrier_names[i].stego_name;
+    }
+    return NULL;
+}
+
+/*Function to set up layout of the original format*/
+void carrier_legacy_layout(long file_size, CarrierLayout *layout)
+{
+    memset(layout, 0, sizeof(*layout));
+    layout->format = "bmp";
+    layout->data_offset = BMP_HEADER_SIZE;
+    layout->capacity = file_size > BMP_HEADER_SIZE ? file_size - BMP_HEADER_SIZE : 0;
+    layout->rows = 1;
+    layout->row_bytes = layout->row_stride = layout->capacity;
+    layout->pixel_stride = 3;
+    layout->contiguous = 1;
+    layout->kernel = &contiguous_kernel;
+}
+
+/*Function to check layout matches the one of the original format*/
+int carrier_is_legacy(const CarrierLayout *layout)
+{
+    return layout->contiguous && layout->data_offset == BMP_HEADER_SIZE;
+}
+
+/*Function to get file offset of logical carrier byte*/
+long carrier_phys_offset(const CarrierLayout *layout, long pos)
+{
+    long row, col;
+
+    if (layout->contiguous)
+        return layout->data_offset + pos;
+    if (pos >= layout->capacity)
+        return layout->data_offset + layout->rows * layout->row_stride;
+
+    row = pos / layout->row_bytes;
+    col = pos % layout->row_bytes;
+    return layout->data_offset + row * layout->row_stride + col / 3 * layout->pixel_stride + layout->pixel_skip + col % 3;
+}
+
+/*Function to embed n payload bytes from logical offset pos*/
+void carrier_embed(const CarrierLayout *layout, char *buf, long base, long pos, const char *data, long n, int bits)
+{
+    if (n > 0)
+        layout->kernel->embed(layout, buf, base, pos, data, n, bits);
+}
+
+/*Function to extract n payload bytes from logical offset pos*/
+void carrier_extract(const CarrierLayout *layout, const unsigned char *buf, long base, long pos, char *data, long n, int bits)
+{
+    if (n > 0)
+        layout->kernel->extract(layout, buf, base, pos, data, n, bits);
+}
@@ -0,0 +1,82 @@
+#ifndef CARRIER_H
+#define CARRIER_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Carrier layout of an image
+ * Only colour bytes of pixels carry payload bits: row padding and
+ * alpha bytes are skipped. Rows are used in file order, whether the
+ * image is stored bottom-up or top-down. The layout is a few numbers
+ * worked out once from the header, a logical carrier offset maps to
+ * a file offset with one division.
+ *
+ * Each format has a parser that fills in the layout, the format is
+ * found from the header bytes. The embed/extract kernel is picked
+ * once per layout: one span for contiguous pixels (24 bit bmp without
+ * padding, ppm, pgm), row spans for padded rows and pixel spans when
+ * alpha bytes sit between pixels.
+ */
+
+/* Bytes of an image header we look at, enough for a pnm with comments */
+#define CARRIER_PARSE_SIZE 512
+
+/* Bytes of a bmp header we look at, file header + info header + colour masks */
+#define BMP_PARSE_SIZE 70
+
+typedef struct _CarrierLayout CarrierLayout;
+
+/* Embed/extract routines specialised for one kind of layout */
+typedef struct _CarrierKernel
+{
+    void (*embed)(const CarrierLayout *layout, char *buf, long base, long pos, const char *data, long n, int bits);
+    void (*extract)(const CarrierLayout *layout, const unsigned char *buf, long base, long pos, char *data, long n, int bits);
+} CarrierKernel;
+
+/* Usable bytes of a carrier image */
+struct _CarrierLayout
+{
+    const char *format;     // "bmp" or "pnm"
+    long data_offset;       // file offset of first pixel row
+    long row_stride;        // bytes per stored row, padding included
+    long rows;
+    long row_bytes;         // usable bytes per row
+    int pixel_stride;       // bytes per pixel in the file, 1, 3 or 4
+    int pixel_skip;         // alpha bytes before the colour bytes of a pixel
+    long capacity;          // usable bytes in the image
+    int contiguous;         // no padding or alpha, one span from data_offset
+    const CarrierKernel *kernel;
+};
+
+/*
+ * Build layout from image header, header holds header_len bytes from
+ * the start of the file. Fails when no format knows the header
+ */
+Status carrier_parse_layout(const unsigned char *header, long header_len, long file_size, CarrierLayout *layout);
+
+/* Format parsers, they fill in the geometry and leave the kernel to carrier_parse_layout */
+Status bmp_parse_layout(const unsigned char *header, long header_len, long file_size, CarrierLayout *layout);
+Status pnm_parse_layout(const unsigned char *header, long header_len, long file_size, CarrierLayout *layout);
+
+/* Stego image name used when none is given, NULL if fname is not a carrier image name */
+const char *carrier_stego_name(const char *fname);
+
+/* Layout of the original format: every byte after the 54 byte header */
+void carrier_legacy_layout(long file_size, CarrierLayout *layout);
+
+/* Layout is the one the original format used, images can keep the old magic */
+int carrier_is_legacy(const CarrierLayout *layout);
+
+/* File offset of logical carrier byte pos, pos == capacity gives end of pixel data */
+long carrier_phys_offset(const CarrierLayout *layout, long pos);
+
+/*
+ * Embed n payload bytes at bits per carrier byte from logical offset pos
+ * buf holds the image from file offset base onwards
+ */
+void carrier_embed(const CarrierLayout *layout, char *buf, long base, long pos, const char *data, long n, int bits);
+
+/* Extract n payload bytes at bits per carrier byte from logical offset pos */
+void carrier_extract(const CarrierLayout *layout, const unsigned char *buf, long base, long pos, char *data, long n, int bits);
+
+#endif
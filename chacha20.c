@@ -0,0 +1,260 @@
+#include <stdint.h>
+#include <string.h>
+#include "chacha20.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#include <pthread.h>
+#define CHACHA_SSE2 1
+#endif
+
+/* Keystream bytes per block */
+#define CHACHA_BLOCK 64
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d) do { \
+    a += b; d ^= a; d = ROTL32(d, 16);  \
+    c += d; b ^= c; b = ROTL32(b, 12);  \
+    a += b; d ^= a; d = ROTL32(d, 8);   \
+    c += d; b ^= c; b = ROTL32(b, 7);   \
+} while (0)
+
+/*Function to read little endian 32 bit value*/
+static uint32_t load_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*Function to set up the state for key and nonce*/
+void chacha20_init(ChaCha20 *ctx, const unsigned char *key, const unsigned char *nonce)
+{
+    int i;
+
+    //"expand 32-byte k"
+    ctx->state[0] = 0x61707865;
+    ctx->state[1] = 0x3320646e;
+    ctx->state[2] = 0x79622d32;
+    ctx->state[3] = 0x6b206574;
+    for (i = 0; i < 8; i++)
+        ctx->state[4 + i] = load_le32(key + 4 * i);
+    ctx->state[12] = 0;
+    for (i = 0; i < 3; i++)
+        ctx->state[13 + i] = load_le32(nonce + 4 * i);
+}
+
+/*Function to make one keystream block for block counter*/
+static void chacha20_block(const ChaCha20 *ctx, uint32_t counter, unsigned char *out)
+{
+    uint32_t x[16];
+    int i;
+
+    memcpy(x, ctx->state, sizeof(x));
+    x[12] = counter;
+    for (i = 0; i < 10; i++)
+    {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (i = 0; i < 16; i++)
+    {
+        uint32_t v = x[i] + (i == 12 ? counter : ctx->state[i]);
+
+        out[4 * i] = v;
+        out[4 * i + 1] = v >> 8;
+        out[4 * i + 2] = v >> 16;
+        out[4 * i + 3] = v >> 24;
+    }
+}
+
+#ifdef CHACHA_SSE2
+#define ROTL128(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define QUARTER_ROUND4(a, b, c, d) do { \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 16); \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 12); \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 8);  \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 7);  \
+} while (0)
+
+/*Function to xor 4 blocks of data with keystream, lane i of each vector is block counter + i*/
+static void chacha20_xor4(const ChaCha20 *ctx, uint32_t counter, unsigned char *dst, const unsigned char *src)
+{
+    __m128i x[16], in[16];
+    int i;
+
+    for (i = 0; i < 16; i++)
+        in[i] = _mm_set1_epi32(ctx->state[i]);
+    in[12] = _mm_add_epi32(_mm_set1_epi32(counter), _mm_set_epi32(3, 2, 1, 0));
+    memcpy(x, in, sizeof(x));
+
+    for (i = 0; i < 10; i++)
+    {
+        QUARTER_ROUND4(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND4(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND4(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND4(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND4(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND4(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND4(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND4(x[3], x[4], x[9], x[14]);
+    }
+
+    //transpose 4 words of 4 blocks at a time: word group g of block b lands at b * 64 + g * 16
+    for (i = 0; i < 16; i += 4)
+    {
+        __m128i a = _mm_add_epi32(x[i], in[i]);
+        __m128i b = _mm_add_epi32(x[i + 1], in[i + 1]);
+        __m128i c = _mm_add_epi32(x[i + 2], in[i + 2]);
+        __m128i d = _mm_add_epi32(x[i + 3], in[i + 3]);
+        __m128i ab_lo = _mm_unpacklo_epi32(a, b), ab_hi = _mm_unpackhi_epi32(a, b);
+        __m128i cd_lo = _mm_unpacklo_epi32(c, d), cd_hi = _mm_unpackhi_epi32(c, d);
+        __m128i k[4];
+        int b4;
+
+        k[0] = _mm_unpacklo_epi64(ab_lo, cd_lo);
+        k[1] = _mm_unpackhi_epi64(ab_lo, cd_lo);
+        k[2] = _mm_unpacklo_epi64(ab_hi, cd_hi);
+        k[3] = _mm_unpackhi_epi64(ab_hi, cd_hi);
+        for (b4 = 0; b4 < 4; b4++)
+        {
+            long off = b4 * CHACHA_BLOCK + i * 4;
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + off));
+
+            _mm_storeu_si128((__m128i *)(dst + off), _mm_xor_si128(v, k[b4]));
+        }
+    }
+}
+
+#define ROTL256(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+/* Rotates by whole bytes are a single shuffle */
+#define ROTL256_BYTES(v, mask) _mm256_shuffle_epi8(v, mask)
+
+#define QUARTER_ROUND8(a, b, c, d) do { \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = ROTL256_BYTES(d, rot16); \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = ROTL256(b, 12);          \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = ROTL256_BYTES(d, rot8);  \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = ROTL256(b, 7);           \
+} while (0)
+
+/*Function to xor 8 blocks of data with keystream, lane i of each vector is block counter + i*/
+__attribute__((target("avx2")))
+static void chacha20_xor8(const ChaCha20 *ctx, uint32_t counter, unsigned char *dst, const unsigned char *src)
+{
+    const __m256i rot16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                          13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+    const __m256i rot8 = _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+                                         14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+    __m256i x[16], in[16];
+    int i;
+
+    for (i = 0; i < 16; i++)
+        in[i] = _mm256_set1_epi32(ctx->state[i]);
+    in[12] = _mm256_add_epi32(_mm256_set1_epi32(counter), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    memcpy(x, in, sizeof(x));
+
+    for (i = 0; i < 10; i++)
+    {
+        QUARTER_ROUND8(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND8(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND8(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND8(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND8(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND8(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND8(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND8(x[3], x[4], x[9], x[14]);
+    }
+
+    //same transpose as chacha20_xor4 in each 128 bit half, the high half holds blocks 4 to 7
+    for (i = 0; i < 16; i += 4)
+    {
+        __m256i a = _mm256_add_epi32(x[i], in[i]);
+        __m256i b = _mm256_add_epi32(x[i + 1], in[i + 1]);
+        __m256i c = _mm256_add_epi32(x[i + 2], in[i + 2]);
+        __m256i d = _mm256_add_epi32(x[i + 3], in[i + 3]);
+        __m256i ab_lo = _mm256_unpacklo_epi32(a, b), ab_hi = _mm256_unpackhi_epi32(a, b);
+        __m256i cd_lo = _mm256_unpacklo_epi32(c, d), cd_hi = _mm256_unpackhi_epi32(c, d);
+        __m256i k[4];
+        int b4;
+
+        k[0] = _mm256_unpacklo_epi64(ab_lo, cd_lo);
+        k[1] = _mm256_unpackhi_epi64(ab_lo, cd_lo);
+        k[2] = _mm256_unpacklo_epi64(ab_hi, cd_hi);
+        k[3] = _mm256_unpackhi_epi64(ab_hi, cd_hi);
+        for (b4 = 0; b4 < 4; b4++)
+        {
+            long lo = b4 * CHACHA_BLOCK + i * 4, hi = lo + 4 * CHACHA_BLOCK;
+            __m128i vlo = _mm_loadu_si128((const __m128i *)(src + lo));
+            __m128i vhi = _mm_loadu_si128((const __m128i *)(src + hi));
+
+            _mm_storeu_si128((__m128i *)(dst + lo), _mm_xor_si128(vlo, _mm256_castsi256_si128(k[b4])));
+            _mm_storeu_si128((__m128i *)(dst + hi), _mm_xor_si128(vhi, _mm256_extracti128_si256(k[b4], 1)));
+        }
+    }
+}
+
+static int use_avx2;
+static pthread_once_t chacha_once = PTHREAD_ONCE_INIT;
+
+/*Function to check once per process for avx2*/
+static void init_chacha(void)
+{
+    __builtin_cpu_init();
+    use_avx2 = __builtin_cpu_supports("avx2");
+}
+#endif
+
+/*Function to xor n bytes with keystream starting at byte offset*/
+void chacha20_xor(const ChaCha20 *ctx, long offset, char *dst, const char *src, long n)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+    uint32_t counter = offset / CHACHA_BLOCK;
+    long skip = offset % CHACHA_BLOCK;
+    unsigned char ks[CHACHA_BLOCK];
+    long i;
+
+    //offset inside a block: use the rest of that block first
+    if (skip && n > 0)
+    {
+        long count = CHACHA_BLOCK - skip < n ? CHACHA_BLOCK - skip : n;
+
+        chacha20_block(ctx, counter++, ks);
+        for (i = 0; i < count; i++)
+            d[i] = s[i] ^ ks[skip + i];
+        d += count;
+        s += count;
+        n -= count;
+    }
+
+#ifdef CHACHA_SSE2
+    //as many blocks per step as the vectors have lanes
+    pthread_once(&chacha_once, init_chacha);
+    if (use_avx2)
+    {
+        for ( ; n >= 8 * CHACHA_BLOCK; n -= 8 * CHACHA_BLOCK, d += 8 * CHACHA_BLOCK, s += 8 * CHACHA_BLOCK, counter += 8)
+            chacha20_xor8(ctx, counter, d, s);
+    }
+    for ( ; n >= 4 * CHACHA_BLOCK; n -= 4 * CHACHA_BLOCK, d += 4 * CHACHA_BLOCK, s += 4 * CHACHA_BLOCK, counter += 4)
+        chacha20_xor4(ctx, counter, d, s);
+#endif
+
+    for ( ; n > 0; counter++)
+    {
+        long count = n < CHACHA_BLOCK ? n : CHACHA_BLOCK;
+
+        chacha20_block(ctx, counter, ks);
+        for (i = 0; i < count; i++)
+            d[i] = s[i] ^ ks[i];
+        d += count;
+        s += count;
+        n -= count;
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef CHACHA20_H
+#define CHACHA20_H
+
+#include <stdint.h>
+
+/*
+ * ChaCha20 stream cipher (RFC 8439) for payload bytes
+ * The keystream is addressed by byte offset, so any slice of the
+ * payload can be encrypted or decrypted on its own and in any order.
+ * Encrypting and decrypting are the same xor.
+ */
+
+#define CHACHA20_KEY_SIZE 32
+#define CHACHA20_NONCE_SIZE 12
+
+/* Key and nonce expanded into the initial state, read only once set up */
+typedef struct _ChaCha20
+{
+    uint32_t state[16];
+} ChaCha20;
+
+/* Set up ctx for key and nonce, block counter starts at 0 */
+void chacha20_init(ChaCha20 *ctx, const unsigned char *key, const unsigned char *nonce);
+
+/* Xor n bytes of src with keystream from byte offset into dst, src may be dst */
+void chacha20_xor(const ChaCha20 *ctx, long offset, char *dst, const char *src, long n);
+
+#endif
@@ -4,4 +4,46 @@
 /* Magic string to identify whether stegged or not */
 #define MAGIC_STRING "#*"
 
+/*
+ * Magic string of images using format extensions, followed by a
+ * 32 bit flags word. Header fields stay at 1 bit per carrier byte,
+ * flags describe how the payload is stored
+ */
+#define MAGIC_STRING_V2 "#+"
+
+/* Flags word: payload bits per carrier byte (1, 2 or 4) in the low nibble */
+#define FLAG_LSB_BITS_MASK 0x0000000F
+
+/* Payload is lz compressed, a 32 bit original size follows the file size */
+#define FLAG_LZ 0x00000010
+
+/* 32 bit CRC32C of the embedded payload follows the sizes, of the ciphertext when encrypted */
+#define FLAG_CRC32C 0x00000020
+
+/* Payload is ChaCha20 encrypted, the 12 byte nonce follows the crc */
+#define FLAG_CHACHA20 0x00000040
+
+/* Payload is spread over the carrier in key ordered blocks, see scatter.h */
+#define FLAG_SCATTER 0x00000080
+
+/* Payload is an archive of several files with an index in front, see archive.h */
+#define FLAG_ARCHIVE 0x00000100
+
+/* Payload is one shard of a larger file, shard fields follow the nonce, see shard.h */
+#define FLAG_SHARD 0x00000200
+
+#define FLAG_KNOWN_MASK (FLAG_LSB_BITS_MASK | FLAG_LZ | FLAG_CRC32C | FLAG_CHACHA20 | FLAG_SCATTER | FLAG_ARCHIVE | FLAG_SHARD)
+
+/* Payload bytes checksummed and encrypted per step, the embed or extract of the block follows while it is in cache */
+#define PAYLOAD_BLOCK_SIZE (16 * 1024)
+
+/* Longest secret file extension stored in stego image, dot included */
+#define MAX_FILE_SUFFIX 8
+
+/* Size of bmp file header + info header */
+#define BMP_HEADER_SIZE 54
+
+/* Phase progress message, silenced for library and quiet runs */
+#define PHASE_MSG(opts, ...) do { if (!(opts).quiet) printf(__VA_ARGS__); } while (0)
+
 #endif
@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC_X86 1
+#endif
+
+/* Castagnoli polynomial, bit reflected */
+#define CRC32C_POLY 0x82F63B78u
+
+typedef uint32_t (*crc_fn)(uint32_t crc, const unsigned char *p, long n);
+
+/* Slicing tables: table[k][b] is the crc of byte b followed by k zero bytes */
+static uint32_t crc_table[8][256];
+
+/* x^(2^n) mod poly, used to shift a crc over a run of zero bytes */
+static uint32_t x2n_table[32];
+
+static crc_fn active_crc;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/*Function to update crc 8 bytes at a time with table lookups*/
+static uint32_t crc_slice8(uint32_t crc, const unsigned char *p, long n)
+{
+    //byte steps until p is aligned
+    for ( ; n > 0 && ((uintptr_t)p & 7); n--)
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+    for ( ; n >= 8; n -= 8, p += 8)
+    {
+        uint32_t lo, hi;
+
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^
+              crc_table[5][(lo >> 16) & 0xFF] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+              crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+    }
+
+    for ( ; n > 0; n--)
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef CRC_X86
+/*Function to update crc with the sse4.2 crc32 instruction*/
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const unsigned char *p, long n)
+{
+    uint64_t crc64;
+
+    for ( ; n > 0 && ((uintptr_t)p & 7); n--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    crc64 = crc;
+    for ( ; n >= 8; n -= 8, p += 8)
+    {
+        uint64_t v;
+
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+    }
+    crc = (uint32_t)crc64;
+
+    for ( ; n > 0; n--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+/*Function to multiply a and b modulo the polynomial, both bit reflected*/
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31, p = 0;
+
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/*Function to fill tables and pick the crc routine once per process*/
+static void init_crc(void)
+{
+    int i, k;
+
+    for (i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+
+        for (k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc_table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++)
+        for (k = 1; k < 8; k++)
+            crc_table[k][i] = crc_table[0][crc_table[k - 1][i] & 0xFF] ^ (crc_table[k - 1][i] >> 8);
+
+    //x^1, then repeated squaring
+    x2n_table[0] = 1u << 30;
+    for (i = 1; i < 32; i++)
+        x2n_table[i] = multmodp(x2n_table[i - 1], x2n_table[i - 1]);
+
+    active_crc = crc_slice8;
+#ifdef CRC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        active_crc = crc_sse42;
+#endif
+}
+
+/*Function to continue crc over n bytes of data*/
+uint32_t crc32c_update(uint32_t crc, const void *data, long n)
+{
+    pthread_once(&crc_once, init_crc);
+    return ~active_crc(~crc, data, n);
+}
+
+/*Function to combine crcs of two consecutive blocks*/
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, long len2)
+{
+    uint32_t p = 1u << 31;
+    int k = 3;
+
+    pthread_once(&crc_once, init_crc);
+
+    //crc1 times x^(8 * len2): shift it over len2 zero bytes
+    for ( ; len2 > 0; len2 >>= 1, k++)
+    {
+        if (len2 & 1)
+            p = multmodp(x2n_table[k & 31], p);
+    }
+    return multmodp(p, crc1) ^ crc2;
+}
@@ -0,0 +1,19 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli) of payload bytes
+ * Uses the SSE4.2 crc32 instruction when the cpu has it, slicing
+ * by 8 tables otherwise, both give the same value. Start with 0 and
+ * pass the last value back in to continue over the next block.
+ */
+
+/* Continue crc over n bytes of data */
+uint32_t crc32c_update(uint32_t crc, const void *data, long n);
+
+/* CRC of A followed by B from crc1 of A, crc2 of B and the length of B */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, long len2);
+
+#endif
@@ -1,10 +1,18 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "decode.h"
+#include "lsb.h"
+#include "lz.h"
+#include "crc32c.h"
 #include "types.h"
 #include "common.h"
 #include <string.h>
 
-Status Open_files(DecodeInfo *decInfo)
+/*Function to open, size and optionally map the stego image*/
+Status open_stego_image(DecodeInfo *decInfo)
 {
     // Stego Image file
     decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "r");
@@ -17,6 +25,39 @@ Status Open_files(DecodeInfo *decInfo)
     	return e_failure;
     }
 
+    // Find image size, all reads are checked against it
+    struct stat st;
+    if (fstat(fileno(decInfo->fptr_stego_image), &st) != 0)
+    {
+        perror("fstat");
+        return e_failure;
+    }
+    decInfo->stego_image_size = st.st_size;
+
+    // Map the whole stego image, decoding then reads straight from page cache
+    if (decInfo->opts.use_mmap && decInfo->stego_image_size > 0)
+    {
+        decInfo->stego_map = mmap(NULL, decInfo->stego_image_size, PROT_READ, MAP_PRIVATE, fileno(decInfo->fptr_stego_image), 0);
+        if (decInfo->stego_map == MAP_FAILED)
+        {
+            decInfo->stego_map = NULL;
+            perror("mmap");
+            return e_failure;
+        }
+        madvise(decInfo->stego_map, decInfo->stego_image_size, MADV_SEQUENTIAL);
+        STATS_ADD(&decInfo->stats, syscalls, 2);
+    }
+
+    //fopen and fstat
+    STATS_ADD(&decInfo->stats, syscalls, 2);
+    return e_success;
+}
+
+Status Open_files(DecodeInfo *decInfo)
+{
+    if (open_stego_image(decInfo) != e_success)
+        return e_failure;
+
     // Decode file
     decInfo->fptr_decode = fopen(decInfo->decode_fname, "w");
     // Do Error handling
@@ -28,15 +69,98 @@ Status Open_files(DecodeInfo *decInfo)
     	return e_failure;
     }
 
+    STATS_ADD(&decInfo->stats, syscalls, 1);
+
     // No failure return e_success
     return e_success;
 }
 
+/*Function to get next len bytes of stego image*/
+const unsigned char *read_stego_bytes(DecodeInfo *decInfo, long len)
+{
+    const unsigned char *bytes;
+
+    if (len < 0 || decInfo->stego_pos + len > decInfo->stego_image_size)
+        return NULL;
+
+    //header fields come from the block read up front
+    if (decInfo->stego_pos + len <= decInfo->head_len)
+    {
+        bytes = decInfo->head_buf + decInfo->stego_pos;
+        decInfo->stego_pos += len;
+        return bytes;
+    }
+
+    STATS_ADD(&decInfo->stats, bytes_read, len);
+
+    //mapped image: hand out a pointer into the mapping
+    if (decInfo->stego_map)
+    {
+        bytes = decInfo->stego_map + decInfo->stego_pos;
+        decInfo->stego_pos += len;
+        return bytes;
+    }
+
+    //head block only, as in a scan
+    if (decInfo->fptr_stego_image == NULL)
+        return NULL;
+
+    //stdio: read the whole block with one positional read
+    if (len > decInfo->read_buf_size)
+    {
+        unsigned char *buf = realloc(decInfo->read_buf, len);
+        if (buf == NULL)
+            return NULL;
+        decInfo->read_buf = buf;
+        decInfo->read_buf_size = len;
+    }
+    if (pread(fileno(decInfo->fptr_stego_image), decInfo->read_buf, len, decInfo->stego_pos) != len)
+        return NULL;
+    STATS_ADD(&decInfo->stats, syscalls, 1);
+    decInfo->stego_pos += len;
+    return decInfo->read_buf;
+}
+
+/*Function to release buffers and close files*/
+void Close_files(DecodeInfo *decInfo)
+{
+    if (decInfo->own_pool)
+        threadpool_destroy(decInfo->pool);
+    decInfo->pool = NULL;
+    decInfo->own_pool = 0;
+
+    //only unmap what Open_files mapped, caller buffers are left alone
+    if (decInfo->stego_map && decInfo->fptr_stego_image)
+    {
+        munmap(decInfo->stego_map, decInfo->stego_image_size);
+        STATS_ADD(&decInfo->stats, syscalls, 1);
+    }
+    decInfo->stego_map = NULL;
+    free(decInfo->read_buf);
+    decInfo->read_buf = NULL;
+    decInfo->read_buf_size = 0;
+    free(decInfo->head_buf);
+    decInfo->head_buf = NULL;
+    decInfo->head_len = 0;
+
+    if (decInfo->fptr_stego_image)
+    {
+        fclose(decInfo->fptr_stego_image);
+        STATS_ADD(&decInfo->stats, syscalls, 1);
+    }
+    if (decInfo->fptr_decode)
+    {
+        fclose(decInfo->fptr_decode);
+        STATS_ADD(&decInfo->stats, syscalls, 1);
+    }
+    decInfo->fptr_stego_image = decInfo->fptr_decode = NULL;
+}
+
 /*Function to validate input arguments from user*/ 
 Status read_and_validate_decode_args(char *argv[] , DecodeInfo *decInfo)
 {
     //check if stego file is passed as an argument
-    if(strcmp(strstr(argv[2],".") , ".bmp") == 0)
+    if(carrier_stego_name(argv[2]) != NULL)
     {
         decInfo->stego_image_fname = argv[2];
     }
@@ -56,34 +180,153 @@ Status read_and_validate_decode_args(char *argv[] , DecodeInfo *decInfo)
     return e_success;
 }
 
-/*Function to decode magic string*/
-Status decode_magic_string(DecodeInfo *decInfo)
+/*Function to extract n bytes at bits per carrier byte from logical carrier offset pos*/
+static Status extract_carrier_at(DecodeInfo *decInfo, long pos, char *data, long n, int bits)
+{
+    long len = n * (8 / bits);
+    long start, end;
+    const unsigned char *bytes;
+
+    if (n == 0)
+        return e_success;
+    if (pos + len > decInfo->layout.capacity)
+        return e_failure;
+
+    //one read from first to last carrier byte, padding and alpha included
+    start = carrier_phys_offset(&decInfo->layout, pos);
+    end = carrier_phys_offset(&decInfo->layout, pos + len);
+    decInfo->stego_pos = start;
+    bytes = read_stego_bytes(decInfo, end - start);
+    if (bytes == NULL)
+        return e_failure;
+
+    carrier_extract(&decInfo->layout, bytes, start, pos, data, n, bits);
+    STATS_ADD(&decInfo->stats, carrier_bytes, len);
+    return e_success;
+}
+
+/*Function to extract n bytes at bits per carrier byte from carrier_pos*/
+static Status extract_carrier_bytes(DecodeInfo *decInfo, char *data, long n, int bits)
+{
+    if (extract_carrier_at(decInfo, decInfo->carrier_pos, data, n, bits) != e_success)
+        return e_failure;
+    decInfo->carrier_pos += n * (8 / bits);
+    return e_success;
+}
+
+/*Function to extract n payload bytes, following the block order of a scattered payload*/
+static Status extract_payload_bytes(DecodeInfo *decInfo, char *data, long n)
 {
-    unsigned char char_byte;
-    unsigned char ch = 0;
-    int i,j;
+    long stride = 8 / decInfo->lsb_bits;
 
-    //Make file pointer point to 54th byte
-    fseek(decInfo->fptr_stego_image, 54 , SEEK_SET);
+    if (!(decInfo->header_flags & FLAG_SCATTER))
+        return extract_carrier_bytes(decInfo, data, n, decInfo->lsb_bits);
 
-    //logic to decode magic string
-    for(i = 0 ; i <2 ; i++)
+    //carrier_pos runs through the stream, each run stops at its carrier block end
+    while (n > 0)
     {
-        for(j = 0 ; j < 8 ; j++)
-        {
-            //read 1 byte of data at a time from stego image
-            //decode the lsb of each byte and combine to get a character 
-            fread(&char_byte, 1 , 1 ,decInfo->fptr_stego_image);
-            char_byte = char_byte & 0x01;
-            ch <<= 1;
-            ch = ch | char_byte;
-        }
-        decInfo->magic_string[i] = ch;
+        long count = scatter_run(&decInfo->scatter, decInfo->carrier_pos) / stride;
+
+        if (count > n)
+            count = n;
+        if (extract_carrier_at(decInfo, scatter_pos(&decInfo->scatter, decInfo->carrier_pos), data, count, decInfo->lsb_bits) != e_success)
+            return e_failure;
+        decInfo->carrier_pos += count * stride;
+        data += count;
+        n -= count;
     }
-    decInfo->magic_string[i] = '\0';
+    return e_success;
+}
+
+/*Function to decode a 32 bit size from next 32 carrier bytes*/
+static Status decode_size_from_lsb(DecodeInfo *decInfo, unsigned int *size)
+{
+    unsigned char bytes[4];
+
+    if (extract_carrier_bytes(decInfo, (char *)bytes, 4, 1) != e_success)
+        return e_failure;
+
+    //most significant byte first
+    *size = ((uint)bytes[0] << 24) | ((uint)bytes[1] << 16) | ((uint)bytes[2] << 8) | bytes[3];
+    return e_success;
+}
+
+/*Function to decode 2 magic string characters from the first carrier bytes*/
+static Status decode_magic_chars(DecodeInfo *decInfo)
+{
+    decInfo->carrier_pos = 0;
+    if (extract_carrier_bytes(decInfo, decInfo->magic_string, 2, 1) != e_success)
+        return e_failure;
+    decInfo->magic_string[2] = '\0';
+    return e_success;
+}
+
+/*Function to decode flags word of a v2 image*/
+static Status decode_header_flags(DecodeInfo *decInfo)
+{
+    if (decode_size_from_lsb(decInfo, &decInfo->header_flags) != e_success)
+        return e_failure;
 
-    //logic to check if magic string is decode properly
-    if(strcmp(decInfo->magic_string , "#*") == 0)
+    //flags from a newer version cannot be decoded safely
+    if (decInfo->header_flags & ~FLAG_KNOWN_MASK)
+        return e_failure;
+    decInfo->lsb_bits = decInfo->header_flags & FLAG_LSB_BITS_MASK;
+    if (decInfo->lsb_bits == 0)
+        decInfo->lsb_bits = 1;
+    if (decInfo->lsb_bits != 1 && decInfo->lsb_bits != 2 && decInfo->lsb_bits != 4)
+        return e_failure;
+    return e_success;
+}
+
+/*Function to read the first DECODE_HEAD_SIZE bytes of the image with one pread*/
+static Status read_stego_head(DecodeInfo *decInfo)
+{
+    long len = decInfo->stego_image_size < DECODE_HEAD_SIZE ? decInfo->stego_image_size : DECODE_HEAD_SIZE;
+    ssize_t ret;
+
+    //mapped image or already read
+    if (decInfo->stego_map || decInfo->head_buf || len <= 0)
+        return e_success;
+
+    decInfo->head_buf = malloc(len);
+    if (decInfo->head_buf == NULL)
+        return e_failure;
+    ret = pread(fileno(decInfo->fptr_stego_image), decInfo->head_buf, len, 0);
+    STATS_ADD(&decInfo->stats, syscalls, 1);
+    if (ret < 0)
+        return e_failure;
+
+    //a short read only means later fields go through read_stego_bytes
+    decInfo->head_len = ret;
+    STATS_ADD(&decInfo->stats, bytes_read, ret);
+    return e_success;
+}
+
+/*Function to decode magic string*/
+Status decode_magic_string(DecodeInfo *decInfo)
+{
+    long header_len = decInfo->stego_image_size < CARRIER_PARSE_SIZE ? decInfo->stego_image_size : CARRIER_PARSE_SIZE;
+    const unsigned char *header;
+
+    decInfo->header_flags = 0;
+    decInfo->lsb_bits = 1;
+
+    //image header and stego header usually sit in the first few hundred bytes
+    if (read_stego_head(decInfo) != e_success)
+        return e_failure;
+
+    //v2 images use the pixel layout from the image header
+    decInfo->stego_pos = 0;
+    header = read_stego_bytes(decInfo, header_len);
+    if (header != NULL && carrier_parse_layout(header, header_len, decInfo->stego_image_size, &decInfo->layout) == e_success &&
+        decode_magic_chars(decInfo) == e_success && strcmp(decInfo->magic_string, MAGIC_STRING_V2) == 0)
+        return decode_header_flags(decInfo);
+
+    //original format, every byte after the 54 byte header at 1 bit per byte
+    carrier_legacy_layout(decInfo->stego_image_size, &decInfo->layout);
+    if (decode_magic_chars(decInfo) != e_success)
+        return e_failure;
+    if(strcmp(decInfo->magic_string , MAGIC_STRING) == 0)
         return e_success;
     else
         return e_failure;
@@ -92,156 +335,711 @@ Status decode_magic_string(DecodeInfo *decInfo)
 /*Function to decode secret file extension size*/
 Status decode_secret_file_extn_size(DecodeInfo *decInfo)
 {
-    unsigned char ch = 0;
-    unsigned int size = 0;
-    int i , j;
+    //store secret file extension size in structure member
+    return decode_size_from_lsb(decInfo, &decInfo->secret_file_extn_size);
+}
+
+/*Function to decode secret file extension*/
+Status decode_secret_file_extn( DecodeInfo *decInfo)
+{
+    unsigned int size = decInfo->secret_file_extn_size;
+
+    //a larger size means the header is damaged
+    if (size > MAX_FILE_SUFFIX)
+        return e_failure;
+
+    //gather secret file extension into structure member
+    if (extract_carrier_bytes(decInfo, decInfo->secret_file_extn, size, 1) != e_success)
+        return e_failure;
+    decInfo->secret_file_extn[size] = '\0';
+
+    return e_success;
+}
+
+/*Function to decode secret file size*/
+Status decode_secret_file_size(DecodeInfo *decInfo)
+{
+    //Logic to decode secret file size and store in structure member
+    if (decode_size_from_lsb(decInfo, &decInfo->secret_file_size) != e_success)
+        return e_failure;
+
+    //compressed payload: original size follows
+    decInfo->raw_file_size = decInfo->secret_file_size;
+    if ((decInfo->header_flags & FLAG_LZ) && decode_size_from_lsb(decInfo, &decInfo->raw_file_size) != e_success)
+        return e_failure;
+    if ((decInfo->header_flags & FLAG_CRC32C) && decode_size_from_lsb(decInfo, &decInfo->stored_crc) != e_success)
+        return e_failure;
 
-    //logic to decode secret file extension size
-    for(i = 0; i < 32 ; i++)
+    //encrypted payload: nonce follows, the key is only needed for the data
+    if (decInfo->header_flags & FLAG_CHACHA20)
     {
-        //read 1 byte of data at a time from stego image
-        //decode lsb from each byte and combine to get secret file extn size
-        fread(&ch, 1 , 1 , decInfo->fptr_stego_image);
-        ch &= 0x01;
-        size <<= 1;
-        size |= ch;
+        if (extract_carrier_bytes(decInfo, (char *)decInfo->nonce, CHACHA20_NONCE_SIZE, 1) != e_success)
+            return e_failure;
+        chacha20_init(&decInfo->cipher, decInfo->opts.key, decInfo->nonce);
     }
-    //store secret file extension size in structure member
-    decInfo->secret_file_extn_size = size;
+    if ((decInfo->header_flags & FLAG_SHARD) &&
+        (decode_size_from_lsb(decInfo, &decInfo->shard.index) != e_success ||
+         decode_size_from_lsb(decInfo, &decInfo->shard.count) != e_success ||
+         decode_size_from_lsb(decInfo, &decInfo->shard.id) != e_success ||
+         decode_size_from_lsb(decInfo, &decInfo->shard.offset) != e_success ||
+         decode_size_from_lsb(decInfo, &decInfo->shard.total) != e_success))
+        return e_failure;
+
+    //a payload larger than the rest of the image means the header is damaged
+    if ((long)decInfo->secret_file_size * (8 / decInfo->lsb_bits) > decInfo->layout.capacity - decInfo->carrier_pos)
+        return e_failure;
+    decInfo->payload_start = decInfo->carrier_pos;
     return e_success;
 }
 
-/*Function to decode secret file extension*/
-Status decode_secret_file_extn( DecodeInfo *decInfo)
+/*Function to check the key and set up block order before payload bytes are read*/
+static Status prepare_payload_access(DecodeInfo *decInfo)
+{
+    if ((decInfo->header_flags & (FLAG_CHACHA20 | FLAG_SCATTER)) && !decInfo->opts.encrypt)
+    {
+        fprintf(stderr, "ERROR: payload is encrypted or scattered, a key is needed to decode it\n");
+        return e_failure;
+    }
+
+    //scattered payload: block order from the key, blocks start right after the header
+    if ((decInfo->header_flags & FLAG_SCATTER) &&
+        scatter_init(&decInfo->scatter, decInfo->opts.key, decInfo->payload_start, decInfo->layout.capacity,
+                     (long)decInfo->secret_file_size * (8 / decInfo->lsb_bits)) != e_success)
+        return e_failure;
+    return e_success;
+}
+
+/* Range of payload decoded by one worker */
+typedef struct
+{
+    DecodeInfo *decInfo;
+    long carrier_off;       // logical carrier offset of first payload bit
+    long data_off;          // output file offset
+    long size;
+    uint32_t crc;           // CRC32C of the slice payload
+    Status status;
+} ExtractSlice;
+
+/*Function to read len stego bytes at off without touching shared state*/
+static const unsigned char *pread_stego_bytes(DecodeInfo *decInfo, long off, long len, unsigned char *buf)
+{
+    long done = 0;
+    ssize_t ret;
+
+    STATS_ADD(&decInfo->stats, bytes_read, len);
+
+    //shared mapping needs no copy at all
+    if (decInfo->stego_map)
+        return decInfo->stego_map + off;
+
+    while (done < len)
+    {
+        ret = pread(fileno(decInfo->fptr_stego_image), buf + done, len - done, off + done);
+        STATS_ADD(&decInfo->stats, syscalls, 1);
+        if (ret <= 0)
+            return NULL;
+        done += ret;
+    }
+    return buf;
+}
+
+/*Function to checksum and decrypt one extracted payload block in place*/
+static void open_payload_block(DecodeInfo *decInfo, char *data, long count, long offset, uint32_t *crc)
+{
+    //block was just extracted, it is still in cache for both passes
+    //crc is of the bytes as embedded, so it is taken before decrypting
+    if (decInfo->header_flags & FLAG_CRC32C)
+        *crc = crc32c_update(*crc, data, count);
+    if (decInfo->header_flags & FLAG_CHACHA20)
+        chacha20_xor(&decInfo->cipher, offset, data, data, count);
+}
+
+/*Function run by a worker to decode one slice into the output file*/
+static void extract_slice_task(void *arg)
+{
+    ExtractSlice *slice = arg;
+    DecodeInfo *decInfo = slice->decInfo;
+    unsigned char *carrier = NULL;
+    long carrier_size = 0;
+    char *str = malloc(DECODE_CHUNK_SIZE);
+    long stride = 8 / decInfo->lsb_bits;
+    long done = 0;
+
+    slice->status = e_failure;
+    slice->crc = 0;
+    if (str == NULL)
+        return;
+
+    while (done < slice->size)
+    {
+        long count = slice->size - done < DECODE_CHUNK_SIZE ? slice->size - done : DECODE_CHUNK_SIZE;
+        long pos = slice->carrier_off + done * stride;
+        long start, end;
+        const unsigned char *bytes;
+        long written = 0;
+        ssize_t ret;
+
+        //scattered payload: one carrier block per step
+        if (decInfo->header_flags & FLAG_SCATTER)
+        {
+            if (count > scatter_run(&decInfo->scatter, pos) / stride)
+                count = scatter_run(&decInfo->scatter, pos) / stride;
+            pos = scatter_pos(&decInfo->scatter, pos);
+        }
+        start = carrier_phys_offset(&decInfo->layout, pos);
+        end = carrier_phys_offset(&decInfo->layout, pos + count * stride);
+
+        //padding and alpha make the file range longer than the carrier bytes
+        if (decInfo->stego_map == NULL && end - start > carrier_size)
+        {
+            unsigned char *buf = realloc(carrier, end - start);
+            if (buf == NULL)
+                break;
+            carrier = buf;
+            carrier_size = end - start;
+        }
+        bytes = pread_stego_bytes(decInfo, start, end - start, carrier);
+        if (bytes == NULL)
+            break;
+
+        //output buffer: extract straight to the final place
+        if (decInfo->decode_buffer)
+        {
+            carrier_extract(&decInfo->layout, bytes, start, pos, decInfo->decode_buffer + slice->data_off + done, count, decInfo->lsb_bits);
+            open_payload_block(decInfo, decInfo->decode_buffer + slice->data_off + done, count, slice->data_off + done, &slice->crc);
+            STATS_ADD(&decInfo->stats, bytes_written, count);
+            done += count;
+            continue;
+        }
+        carrier_extract(&decInfo->layout, bytes, start, pos, str, count, decInfo->lsb_bits);
+        open_payload_block(decInfo, str, count, slice->data_off + done, &slice->crc);
+
+        //positional write puts the slice at its final place in the output
+        while (written < count)
+        {
+            ret = pwrite(fileno(decInfo->fptr_decode), str + written, count - written, slice->data_off + done + written);
+            STATS_ADD(&decInfo->stats, syscalls, 1);
+            if (ret <= 0)
+                break;
+            STATS_ADD(&decInfo->stats, bytes_written, ret);
+            written += ret;
+        }
+        if (written < count)
+            break;
+        done += count;
+    }
+
+    if (done == slice->size)
+        slice->status = e_success;
+    free(carrier);
+    free(str);
+}
+
+/*Function to decode secret file data with slices on the thread pool*/
+Status decode_data_parallel(DecodeInfo *decInfo)
+{
+    long size = decInfo->secret_file_size;
+    long start = decInfo->carrier_pos;
+    int nslices, i;
+    long per_slice, off = 0;
+    long stride = 8 / decInfo->lsb_bits;
+    Status ret = e_success;
+
+    if (start + size * stride > decInfo->layout.capacity)
+        return e_failure;
+
+    if (decInfo->pool == NULL)
+    {
+        decInfo->pool = threadpool_create(decInfo->opts.threads);
+        if (decInfo->pool == NULL)
+            return e_failure;
+        decInfo->own_pool = 1;
+    }
+
+    //payload byte i sits at start + stride * i, so slices need no coordination
+    nslices = threadpool_size(decInfo->pool);
+    ExtractSlice slices[nslices];
+    per_slice = (size + nslices - 1) / nslices;
+
+    for(i = 0 ; i < nslices && off < size ; i++)
+    {
+        slices[i].decInfo = decInfo;
+        slices[i].carrier_off = start + off * stride;
+        slices[i].data_off = off;
+        slices[i].size = size - off < per_slice ? size - off : per_slice;
+        off += slices[i].size;
+
+        if (threadpool_submit(decInfo->pool, extract_slice_task, &slices[i]) != e_success)
+            extract_slice_task(&slices[i]);
+    }
+    nslices = i;
+    threadpool_wait(decInfo->pool);
+    STATS_ADD(&decInfo->stats, carrier_bytes, size * stride);
+
+    //crc of the payload from the crcs of its slices
+    for(i = 0 ; i < nslices ; i++)
+    {
+        if (slices[i].status != e_success)
+            ret = e_failure;
+        decInfo->payload_crc = crc32c_combine(decInfo->payload_crc, slices[i].crc, slices[i].size);
+    }
+    decInfo->carrier_pos = start + size * stride;
+    return ret;
+}
+
+/*Function to compare crc of the extracted payload with the one in the header*/
+static Status check_payload_crc(DecodeInfo *decInfo)
+{
+    if (!(decInfo->header_flags & FLAG_CRC32C) || decInfo->payload_crc == decInfo->stored_crc)
+        return e_success;
+    fprintf(stderr, "ERROR: payload CRC32C is %08x, header says %08x, stego image is damaged\n",
+            decInfo->payload_crc, decInfo->stored_crc);
+    return e_failure;
+}
+
+/*Function to extract payload bytes into the output file or buffer*/
+static Status extract_secret_file_data(DecodeInfo *decInfo)
+{
+    char str[DECODE_CHUNK_SIZE];
+    unsigned int done = 0;
+
+    //without an output file the output buffer must hold the whole payload
+    if (decInfo->fptr_decode == NULL && decInfo->secret_file_size > decInfo->decode_buffer_size)
+        return e_failure;
+
+    //large payloads are split across worker threads
+    decInfo->payload_crc = 0;
+    if ((decInfo->opts.threads > 1 || decInfo->pool) && decInfo->secret_file_size > DECODE_CHUNK_SIZE)
+    {
+        if (decode_data_parallel(decInfo) != e_success)
+            return e_failure;
+        return check_payload_crc(decInfo);
+    }
+
+    //decode in fixed size chunks, each chunk is one read of the stego image
+    while (done < decInfo->secret_file_size)
+    {
+        unsigned int count = decInfo->secret_file_size - done;
+        if (count > DECODE_CHUNK_SIZE)
+            count = DECODE_CHUNK_SIZE;
+
+        //output buffer: extract straight into it, nothing to write
+        if (decInfo->decode_buffer)
+        {
+            if (extract_payload_bytes(decInfo, decInfo->decode_buffer + done, count) != e_success)
+                return e_failure;
+            open_payload_block(decInfo, decInfo->decode_buffer + done, count, done, &decInfo->payload_crc);
+            STATS_ADD(&decInfo->stats, bytes_written, count);
+            done += count;
+            continue;
+        }
+
+        //extract whole payload bytes straight into the output buffer
+        if (extract_payload_bytes(decInfo, str, count) != e_success)
+            return e_failure;
+        open_payload_block(decInfo, str, count, done, &decInfo->payload_crc);
+
+        //write decoded secret file data into output file 
+        if (fwrite(str, count, 1, decInfo->fptr_decode) != 1)
+            return e_failure;
+        STATS_ADD(&decInfo->stats, syscalls, 1);
+        STATS_ADD(&decInfo->stats, bytes_written, count);
+        done += count;
+    }
+    return check_payload_crc(decInfo);
+}
+
+
+/*Function to extract the compressed payload block by block and inflate it into the output*/
+static Status decode_compressed_data(DecodeInfo *decInfo)
 {
-    unsigned char ch = 0;
-    int i,j;
+    char *out = decInfo->decode_buffer;
+    long size = decInfo->secret_file_size;
+    long raw = decInfo->raw_file_size;
+    long bound = lz_compress_bound(LZ_BLOCK_SIZE);
+    long done = 0, used = 0;
+    char *block, *chunk = NULL;
+    Status ret = e_success;
 
-    //logic to decode secret file file extension and store in structure member
-    for(i = 0 ; i < 4 ; i++)
+    //without an output file the output buffer must hold the original size
+    if (decInfo->fptr_decode == NULL && raw > decInfo->decode_buffer_size)
+        return e_failure;
+
+    //one stored and one inflated block in memory, whatever the payload size
+    block = malloc(bound);
+    if (block == NULL || (out == NULL && (chunk = malloc(LZ_BLOCK_SIZE)) == NULL))
     {
-        unsigned char char_byte = 0;
-        for(j = 0 ; j < 8 ; j++)
+        free(block);
+        return e_failure;
+    }
+
+    decInfo->payload_crc = 0;
+    while (ret == e_success && done < raw)
+    {
+        long len = raw - done < LZ_BLOCK_SIZE ? raw - done : LZ_BLOCK_SIZE;
+        char *dst = out ? out + done : chunk;
+        long stored;
+
+        //block header says how many payload bytes the block takes
+        if (size - used < 4 || extract_payload_bytes(decInfo, block, 4) != e_success)
+        {
+            ret = e_failure;
+            break;
+        }
+        open_payload_block(decInfo, block, 4, used, &decInfo->payload_crc);
+        stored = lz_block_size(block);
+        if (stored <= 4 || stored > bound || stored > size - used ||
+            extract_payload_bytes(decInfo, block + 4, stored - 4) != e_success)
         {
-            //read 1 byte of data at a time from stego image
-            //decode the lsb of each byte and combine to get a character 
-            fread(&char_byte, 1 , 1 ,decInfo->fptr_stego_image);
-            char_byte = char_byte & 0x01;
-            ch <<= 1;
-            ch = ch | char_byte;
+            ret = e_failure;
+            break;
+        }
+        open_payload_block(decInfo, block + 4, stored - 4, used + 4, &decInfo->payload_crc);
+
+        //inflate straight into the output buffer or the chunk written out
+        if (lz_decompress_block(block, stored, dst, len) != stored)
+            ret = e_failure;
+        else if (out == NULL && fwrite(chunk, len, 1, decInfo->fptr_decode) != 1)
+            ret = e_failure;
+        else
+        {
+            if (out == NULL)
+                STATS_ADD(&decInfo->stats, syscalls, 1);
+            STATS_ADD(&decInfo->stats, bytes_written, len);
+            used += stored;
+            done += len;
         }
-        decInfo->secret_file_extn[i] = ch;
     }
-    decInfo->secret_file_extn[i] = '\0';
+    if (ret == e_success && used != size)
+        ret = e_failure;
 
-    return e_success;
+    free(chunk);
+    free(block);
+    if (ret != e_success)
+        return e_failure;
+    return check_payload_crc(decInfo);
 }
 
-/*Function to decode secret file size*/
-Status decode_secret_file_size(DecodeInfo *decInfo)
+/*Function to inflate the secret range offset, size from a compressed payload into data, or fptr when data is NULL*/
+static Status decode_compressed_range(DecodeInfo *decInfo, long offset, long size, char *data, FILE *fptr)
 {
-    unsigned char ch = 0;
-    unsigned int size = 0;
-    int i , j;
+    long used = 0, raw = 0;
+    char head[4], *block = NULL, *chunk = NULL;
+    Status ret = e_success;
 
-    //Logic to decode secret file size and store in structure member
-    for(i = 0; i < 32 ; i++)
+    //every block but the last holds LZ_BLOCK_SIZE secret bytes, headers say where the next one starts
+    while (ret == e_success && size > 0)
     {
-        //read 1 byte of data at a time from stego image
-        //decode lsb from each byte and combine to get secret file size
-        fread(&ch, 1 , 1 , decInfo->fptr_stego_image);
-        ch &= 0x01;
-        size <<= 1;
-        size |= ch;
-    } 
-    decInfo->secret_file_size = size;
-    return e_success;
+        long len = (long)decInfo->raw_file_size - raw < LZ_BLOCK_SIZE ? (long)decInfo->raw_file_size - raw : LZ_BLOCK_SIZE;
+        long stored, from, count;
+
+        if (len <= 0 || decode_payload_range(decInfo, used, 4, head) != e_success)
+        {
+            ret = e_failure;
+            break;
+        }
+        stored = lz_block_size(head);
+        if (stored > (long)decInfo->secret_file_size - used)
+        {
+            ret = e_failure;
+            break;
+        }
+
+        //block before the range: only its header was read
+        if (raw + len <= offset)
+        {
+            used += stored;
+            raw += len;
+            continue;
+        }
+
+        if ((block == NULL && (block = malloc(lz_compress_bound(LZ_BLOCK_SIZE))) == NULL) ||
+            (chunk == NULL && (chunk = malloc(LZ_BLOCK_SIZE)) == NULL) ||
+            decode_payload_range(decInfo, used, stored, block) != e_success ||
+            lz_decompress_block(block, stored, chunk, len) != stored)
+        {
+            ret = e_failure;
+            break;
+        }
+        from = offset - raw;
+        count = len - from < size ? len - from : size;
+        if (data)
+        {
+            memcpy(data, chunk + from, count);
+            data += count;
+        }
+        else
+        {
+            //overlapping blocks are streamed out in order, each one inflated once
+            if (fwrite(chunk + from, count, 1, fptr) != 1)
+            {
+                ret = e_failure;
+                break;
+            }
+            STATS_ADD(&decInfo->stats, syscalls, 1);
+            STATS_ADD(&decInfo->stats, bytes_written, count);
+        }
+        offset += count;
+        size -= count;
+        used += stored;
+        raw += len;
+    }
+    free(block);
+    free(chunk);
+    return ret;
+}
+
+/*Function to decode the --range slice of the secret into the output file or buffer*/
+static Status decode_range_data(DecodeInfo *decInfo)
+{
+    long offset = decInfo->opts.range_offset;
+    long size = decInfo->opts.range_length;
+    char *str;
+    Status ret = e_success;
+
+    //a range running past the end stops at the end, as dd does
+    if (offset > (long)decInfo->raw_file_size)
+        return e_failure;
+    if (size > (long)decInfo->raw_file_size - offset)
+        size = decInfo->raw_file_size - offset;
+    if (decInfo->decode_buffer)
+    {
+        if (size > decInfo->decode_buffer_size)
+            return e_failure;
+        return decode_secret_range(decInfo, offset, size, decInfo->decode_buffer);
+    }
+
+    //block headers are walked once for the whole range, not once per chunk
+    if (decInfo->header_flags & FLAG_LZ)
+        return decode_compressed_range(decInfo, offset, size, NULL, decInfo->fptr_decode);
+
+    str = malloc(DECODE_CHUNK_SIZE);
+    if (str == NULL)
+        return e_failure;
+    while (ret == e_success && size > 0)
+    {
+        long count = size < DECODE_CHUNK_SIZE ? size : DECODE_CHUNK_SIZE;
+
+        if (decode_secret_range(decInfo, offset, count, str) != e_success ||
+            fwrite(str, count, 1, decInfo->fptr_decode) != 1)
+            ret = e_failure;
+        STATS_ADD(&decInfo->stats, syscalls, 1);
+        STATS_ADD(&decInfo->stats, bytes_written, count);
+        offset += count;
+        size -= count;
+    }
+    free(str);
+    return ret;
 }
 
 /*Function to create secret file data*/
 Status decode_secret_file_data(DecodeInfo *decInfo)
 {
-    char str[decInfo->secret_file_size];
-    unsigned char ch=0;
-    int i , j;
+    if (prepare_payload_access(decInfo) != e_success)
+        return e_failure;
+    if (decInfo->opts.range)
+        return decode_range_data(decInfo);
+    if (decInfo->header_flags & FLAG_LZ)
+        return decode_compressed_data(decInfo);
+    return extract_secret_file_data(decInfo);
+}
+
+/*Function to extract size bytes of the stored payload from offset, nothing before it is read*/
+Status decode_payload_range(DecodeInfo *decInfo, long offset, long size, char *data)
+{
+    uint32_t crc = 0;
+
+    if (offset < 0 || size < 0 || offset + size > (long)decInfo->secret_file_size)
+        return e_failure;
+    if (prepare_payload_access(decInfo) != e_success)
+        return e_failure;
 
-    //logic to decode secret file data    
-    for(i = 0 ; i < sizeof(str) ; i++)
+    //payload byte i sits at payload_start + stride * i in stream order
+    decInfo->carrier_pos = decInfo->payload_start + offset * (8 / decInfo->lsb_bits);
+    while (size > 0)
     {
-        unsigned char char_byte = 0;
-        for(j = 0 ; j < 8 ; j++)
-        {
-            //read 1 byte of data at a time from stego image
-            //decode lsb from each byte and combine to get a character of secret file data
-            fread(&ch, 1, 1, decInfo->fptr_stego_image);
-            ch &= 0x01;
-            char_byte <<= 1;
-            char_byte |= ch;
-        }
-        str[i] = char_byte;
+        long count = size < DECODE_CHUNK_SIZE ? size : DECODE_CHUNK_SIZE;
+
+        //crc covers the whole payload, a range cannot be checked against it
+        if (extract_payload_bytes(decInfo, data, count) != e_success)
+            return e_failure;
+        open_payload_block(decInfo, data, count, offset, &crc);
+        data += count;
+        offset += count;
+        size -= count;
     }
-    //write decoded secret file data into output file 
-    fwrite(str , sizeof(str), 1 ,decInfo->fptr_decode);
     return e_success;
 }
 
+/*Function to decode secret bytes from offset, nothing outside the range is extracted*/
+Status decode_secret_range(DecodeInfo *decInfo, long offset, long size, char *data)
+{
+    if (offset < 0 || size < 0 || offset + size > (long)decInfo->raw_file_size)
+        return e_failure;
+    if (prepare_payload_access(decInfo) != e_success)
+        return e_failure;
+    if (decInfo->header_flags & FLAG_LZ)
+        return decode_compressed_range(decInfo, offset, size, data, NULL);
+    return decode_payload_range(decInfo, offset, size, data);
+}
 
-Status do_decoding(DecodeInfo *decInfo)
+/*Function to run header decoding phases on already opened stego image*/
+Status decode_header_phases(DecodeInfo *decInfo)
 {
-    if( Open_files(decInfo) == e_success)
-    {
-        printf("Open files is a success\n");
-
-         if(decode_magic_string(decInfo) == e_success)
-         {
-             printf("Decoded magic string\n");
-                           
-             if(decode_secret_file_extn_size(decInfo) == e_success)
-             {
-                 printf("Decoded secret file extension size. It is %d bytes.\n",decInfo->secret_file_extn_size);
-                 if(decode_secret_file_extn(decInfo) == e_success)
-                 {
-                     printf("Decoded secret file extension successfully. It is \"%s\".\n",decInfo->secret_file_extn);
-                     if(decode_secret_file_size(decInfo) == e_success)
-                     {
-                         printf("Decoded secret file size. It is %d bytes.\n", decInfo->secret_file_size);
-                         if(decode_secret_file_data(decInfo) == e_success)
-                         {
-                             printf("Decoded secret file data successfully. Decoded data successfully written in file \"%s\".\n",decInfo->decode_fname);
-                         }
-                         else
-                         {
-                             printf("Failed to decode secret file data\n");
-                         }
-                     }
-                     else
-                     {
-                         printf("Failed to decode secret file size\n");
-                         return e_failure;
-                     }
-                 }
-                 else
-                 {
-                     printf("Faild to decode secret file extn\n");
-                     return e_failure;
-                 }
-                    }
-                    else
-                    {
-                        printf("Failed to decode secret file extension size\n");
-                        return e_failure;
-                    }
+    if(STATS_PHASE(&decInfo->stats, STAT_MAGIC, decode_magic_string(decInfo)) == e_success)
+    {
+        PHASE_MSG(decInfo->opts, "Decoded magic string\n");
+
+        if(STATS_PHASE(&decInfo->stats, STAT_EXTN_SIZE, decode_secret_file_extn_size(decInfo)) == e_success)
+        {
+            PHASE_MSG(decInfo->opts, "Decoded secret file extension size. It is %d bytes.\n",decInfo->secret_file_extn_size);
+            if(STATS_PHASE(&decInfo->stats, STAT_EXTN, decode_secret_file_extn(decInfo)) == e_success)
+            {
+                PHASE_MSG(decInfo->opts, "Decoded secret file extension successfully. It is \"%s\".\n",decInfo->secret_file_extn);
+                if(STATS_PHASE(&decInfo->stats, STAT_FILE_SIZE, decode_secret_file_size(decInfo)) == e_success)
+                {
+                    PHASE_MSG(decInfo->opts, "Decoded secret file size. It is %d bytes.\n", decInfo->secret_file_size);
                 }
                 else
                 {
-                    printf("Failed to decode magic string\n");
+                    PHASE_MSG(decInfo->opts, "Failed to decode secret file size\n");
                     return e_failure;
                 }
+            }
+            else
+            {
+                PHASE_MSG(decInfo->opts, "Faild to decode secret file extn\n");
+                return e_failure;
+            }
+        }
+        else
+        {
+            PHASE_MSG(decInfo->opts, "Failed to decode secret file extension size\n");
+            return e_failure;
+        }
     }
     else
     {
-        printf("Open files is a failure\n");
-        return -1;
+        PHASE_MSG(decInfo->opts, "Failed to decode magic string\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*Function to run decoding phases on already opened stego image*/
+Status decode_phases(DecodeInfo *decInfo)
+{
+    if(decode_header_phases(decInfo) != e_success)
+        return e_failure;
+
+    if(STATS_PHASE(&decInfo->stats, STAT_DATA, decode_secret_file_data(decInfo)) == e_success)
+    {
+        PHASE_MSG(decInfo->opts, "Decoded secret file data successfully. Decoded data successfully written in file \"%s\".\n",decInfo->decode_fname);
+    }
+    else
+    {
+        PHASE_MSG(decInfo->opts, "Failed to decode secret file data\n");
+        return e_failure;
     }
     return e_success;
 }
+
+/*Function to run all decoding phases in order*/
+static Status run_decoding(DecodeInfo *decInfo)
+{
+    if( STATS_PHASE(&decInfo->stats, STAT_OPEN, Open_files(decInfo)) == e_success)
+    {
+        PHASE_MSG(decInfo->opts, "Open files is a success\n");
+        return decode_phases(decInfo);
+    }
+    else
+    {
+        PHASE_MSG(decInfo->opts, "Open files is a failure\n");
+        return -1;
+    }
+}
+
+/*Function to decode, files are always closed so jobs can run back to back*/
+Status do_decoding(DecodeInfo *decInfo)
+{
+    uint64_t start = stats_now_ns();
+    uint64_t close_start;
+    Status ret = run_decoding(decInfo);
+
+    close_start = stats_now_ns();
+    Close_files(decInfo);
+    stats_phase_add(&decInfo->stats, STAT_CLOSE, close_start);
+    decInfo->stats.total_ns = stats_now_ns() - start;
+    return ret;
+}
+
+/*Function to decode only the header, the payload and output file are never touched*/
+Status probe_stego_image(DecodeInfo *decInfo)
+{
+    uint64_t start = stats_now_ns();
+    uint64_t close_start;
+    Status ret = e_failure;
+
+    //one pread of the head is all a probe needs, mapping the image costs more
+    decInfo->opts.use_mmap = 0;
+    if (STATS_PHASE(&decInfo->stats, STAT_OPEN, open_stego_image(decInfo)) == e_success)
+        ret = decode_header_phases(decInfo);
+
+    close_start = stats_now_ns();
+    Close_files(decInfo);
+    stats_phase_add(&decInfo->stats, STAT_CLOSE, close_start);
+    decInfo->stats.total_ns = stats_now_ns() - start;
+    return ret;
+}
+
+/*Function to print one line with the decoded header of fname*/
+void print_stego_header(const char *fname, const DecodeInfo *decInfo)
+{
+    printf("%s: %s, %d bit%s per byte, extension \"%s\", payload %u bytes", fname, decInfo->magic_string,
+           decInfo->lsb_bits, decInfo->lsb_bits > 1 ? "s" : "", decInfo->secret_file_extn, decInfo->raw_file_size);
+    if (decInfo->header_flags & FLAG_LZ)
+        printf(", lz compressed to %u", decInfo->secret_file_size);
+    if (decInfo->header_flags & FLAG_CRC32C)
+        printf(", crc32c %08x", decInfo->stored_crc);
+    if (decInfo->header_flags & FLAG_CHACHA20)
+        printf(", chacha20 encrypted");
+    if (decInfo->header_flags & FLAG_SCATTER)
+        printf(", scattered");
+    if (decInfo->header_flags & FLAG_ARCHIVE)
+        printf(", archive");
+    if (decInfo->header_flags & FLAG_SHARD)
+        printf(", shard %u of %u (id %08x, bytes %u-%u of %u)", decInfo->shard.index + 1, decInfo->shard.count,
+               decInfo->shard.id, decInfo->shard.offset, decInfo->shard.offset + decInfo->raw_file_size, decInfo->shard.total);
+    printf("\n");
+}
+
+/*Function to probe every stego image named in argv*/
+Status probe_images(int argc, char *argv[], const StegoOptions *opts)
+{
+    Status ret = e_success;
+    int i;
+
+    for (i = 2; i < argc; i++)
+    {
+        DecodeInfo decInfo;
+        Status job;
+
+        memset(&decInfo, 0, sizeof(decInfo));
+        decInfo.opts = *opts;
+        decInfo.opts.quiet = 1;
+        decInfo.stego_image_fname = argv[i];
+
+        //the summary line is the result, --quiet does not hide it
+        job = probe_stego_image(&decInfo);
+        if (job == e_success)
+            print_stego_header(argv[i], &decInfo);
+        else
+        {
+            printf("%s: no stego header\n", argv[i]);
+            ret = e_failure;
+        }
+        if (opts->stats_json)
+            stats_print_json(stdout, "probe", argv[i], job, &decInfo.stats);
+    }
+    return ret;
+}
@@ -2,6 +2,13 @@
 #define DECODE_H
 
 #include "types.h" // Contains user defined types
+#include "common.h"
+#include "threadpool.h"
+#include "stats.h"
+#include "carrier.h"
+#include "chacha20.h"
+#include "scatter.h"
+#include "shard.h"
 
 /* 
  * Structure to decode secret file information stored in
@@ -10,6 +17,12 @@
  * also stored
  */
 
+/* Payload bytes decoded per read of the stego image */
+#define DECODE_CHUNK_SIZE (64 * 1024)
+
+/* Stego image bytes read with one pread before the header is decoded */
+#define DECODE_HEAD_SIZE 4096
+
 
 typedef struct _DecodeInfo
 {
@@ -17,16 +30,44 @@ typedef struct _DecodeInfo
     /* Decode File Info */
     char *decode_fname;
     FILE *fptr_decode;
+    char *decode_buffer;            // output buffer instead of fptr_decode
+    long decode_buffer_size;
     char magic_string[3];
-    char secret_file_extn[5];
+    char secret_file_extn[MAX_FILE_SUFFIX + 1];
     unsigned int secret_file_extn_size;
-    unsigned int secret_file_size;
+    unsigned int secret_file_size;  // payload bytes embedded in the image
+    unsigned int raw_file_size;     // size before compression, FLAG_LZ only
+    unsigned int stored_crc;        // payload CRC32C from the header, FLAG_CRC32C only
+    uint32_t payload_crc;           // CRC32C of payload extracted so far
+    unsigned char nonce[CHACHA20_NONCE_SIZE];   // FLAG_CHACHA20 only
+    ChaCha20 cipher;                // key from the options and nonce from the header
+    CarrierScatter scatter;         // block order of a scattered payload
+    ShardHeader shard;              // FLAG_SHARD only
+    uint header_flags;              // flags word of a v2 image, 0 for the original format
+    int lsb_bits;                   // payload bits per carrier byte
     
 
     /* Stego Image Info */
     char *stego_image_fname;
     FILE *fptr_stego_image;
-    
+    long stego_image_size;
+    long stego_pos;                 // file offset of next read_stego_bytes
+    CarrierLayout layout;           // usable pixel bytes of the stego image
+    long carrier_pos;               // next logical carrier byte
+    long payload_start;             // logical carrier offset of the first payload byte
+    unsigned char *stego_map;       // whole image in mmap mode
+    unsigned char *read_buf;        // block read buffer in stdio mode
+    long read_buf_size;
+    unsigned char *head_buf;        // first head_len bytes of the image in stdio mode
+    long head_len;
+
+    /* Run time options */
+    StegoOptions opts;
+    ThreadPool *pool;
+    int own_pool;                   // pool was created here, not handed in
+
+    /* Timers and counters */
+    StegoStats stats;
 
 } DecodeInfo;
 
@@ -39,9 +80,33 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
 /* Perform the decoding */
 Status do_decoding(DecodeInfo *decInfo);
 
+/* Run all phases after the stego image and output are set up */
+Status decode_phases(DecodeInfo *decInfo);
+
+/* Run the phases up to the secret file size, the payload is not read */
+Status decode_header_phases(DecodeInfo *decInfo);
+
+/* Decode header of stego_image_fname only, no output file is created */
+Status probe_stego_image(DecodeInfo *decInfo);
+
+/* Print one line with the decoded header of fname */
+void print_stego_header(const char *fname, const DecodeInfo *decInfo);
+
+/* Probe every stego image from argv[2] on and print one line each */
+Status probe_images(int argc, char *argv[], const StegoOptions *opts);
+
 /* Get File pointers for i/p and o/p files */
 Status Open_files(DecodeInfo *decInfo);
 
+/* Open, size and map the stego image only, there is no output file */
+Status open_stego_image(DecodeInfo *decInfo);
+
+/* Get next len bytes of stego image */
+const unsigned char *read_stego_bytes(DecodeInfo *decInfo, long len);
+
+/* Release buffers and close files */
+void Close_files(DecodeInfo *decInfo);
+
 /* Decode Magic String */
 Status decode_magic_string(DecodeInfo *decInfo);
 
@@ -57,6 +122,21 @@ Status decode_secret_file_size(DecodeInfo *decInfo);
 /* Deocde secret file data */
 Status decode_secret_file_data(DecodeInfo *decInfo);
 
+/* Decode secret file data with slices extracted on the thread pool */
+Status decode_data_parallel(DecodeInfo *decInfo);
+
+/*
+ * Extract size bytes of the stored payload from offset into data
+ * Only the carrier bytes of the range are read, the payload crc is not checked
+ */
+Status decode_payload_range(DecodeInfo *decInfo, long offset, long size, char *data);
+
+/*
+ * Decode size bytes of the secret from offset into data
+ * A compressed payload is walked block by block, only blocks in the range are inflated
+ */
+Status decode_secret_range(DecodeInfo *decInfo, long offset, long size, char *data);
+
 
 
 
@@ -1,34 +1,24 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include "encode.h"
+#include "lsb.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "ring.h"
+#include <sys/random.h>
 #include "types.h"
 #include "common.h"
 #include <string.h>
 
 /* Function Definitions */
 
-/* Get image size
- * Input: Image file ptr
- * Output: width * height * bytes per pixel (3 in our case)
- * Description: In BMP Image, width is stored in offset 18,
- * and height after that. size is 4 bytes
- */
-/*Function to calculate input .bmp file size*/
-uint get_image_size_for_bmp(FILE *fptr_image)
-{
-    uint width, height;
-    // Seek to 18th byte
-    fseek(fptr_image, 18, SEEK_SET);
-
-    // Read the width (an int)
-    fread(&width, sizeof(int), 1, fptr_image);
-
-    // Read the height (an int)
-    fread(&height, sizeof(int), 1, fptr_image);
-
-    // Return image capacity
-    return width * height * 3;
-}
-
 /* 
  * Get File pointers for i/p and o/p files
  * Inputs: Src Image file, Secret file and
@@ -51,19 +41,26 @@ Status open_files(EncodeInfo *encInfo)
     	return e_failure;
     }
 
-    // Secret file
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
-    // Do Error handling
-    if (encInfo->fptr_secret == NULL)
+    // Secret file, unless the secret was built in memory
+    if (encInfo->secret_buffer == NULL)
     {
-    	perror("fopen");
-    	fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->secret_fname);
+        encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
+        // Do Error handling
+        if (encInfo->fptr_secret == NULL)
+        {
+            perror("fopen");
+            fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->secret_fname);
 
-    	return e_failure;
+            return e_failure;
+        }
     }
 
-    // Stego Image file
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
+    // Stego Image file, mapping it needs read access as well
+    // in place the carrier itself is opened again for writing
+    if (encInfo->opts.patch == PATCH_IN_PLACE)
+        encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "r+");
+    else
+        encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, encInfo->opts.use_mmap || encInfo->opts.patch ? "w+" : "w");
     // Do Error handling
     if (encInfo->fptr_stego_image == NULL)
     {
@@ -73,29 +70,285 @@ Status open_files(EncodeInfo *encInfo)
     	return e_failure;
     }
 
-    // No failure return e_success
+    STATS_ADD(&encInfo->stats, syscalls, 3);
+
+    // Patch modes never read the carrier as a whole, only the pages embedding touches
+    if (encInfo->opts.patch)
+        return map_patch_image(encInfo);
+
+    // Load the carrier once, all later phases work on the buffer
+    if (encInfo->opts.use_mmap)
+        return map_src_image(encInfo);
+
+    // Serial stdio encode reads the head only, reads, embedding and writes of the rest overlap
+    encInfo->pipelined = encInfo->opts.threads <= 1 && encInfo->pool == NULL && !encInfo->opts.scatter && !encInfo->opts.compress;
+    return read_src_image(encInfo);
+}
+
+/*Function to read whole source image into memory*/
+Status read_src_image(EncodeInfo *encInfo)
+{
+    //find size of source image
+    fseek(encInfo->fptr_src_image, 0, SEEK_END);
+    encInfo->image_file_size = ftell(encInfo->fptr_src_image);
+    fseek(encInfo->fptr_src_image, 0, SEEK_SET);
+
+    if (encInfo->image_file_size < BMP_HEADER_SIZE)
+    {
+        fprintf(stderr, "ERROR: %s is too small to be a carrier image\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+
+    //pipelined encoder only needs the head, the rest goes through it block by block
+    encInfo->image_copied = encInfo->image_file_size;
+    if (encInfo->pipelined && encInfo->image_copied > ENCODE_HEAD_SIZE)
+        encInfo->image_copied = ENCODE_HEAD_SIZE;
+
+    encInfo->image_buffer = malloc(encInfo->image_copied);
+    if (encInfo->image_buffer == NULL)
+    {
+        perror("malloc");
+        return e_failure;
+    }
+
+    //read complete image with a single call instead of 8 bytes at a time
+    if (fread(encInfo->image_buffer, 1, encInfo->image_copied, encInfo->fptr_src_image) != (size_t)encInfo->image_copied)
+    {
+        fprintf(stderr, "ERROR: Unable to read file %s\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    STATS_ADD(&encInfo->stats, syscalls, 3);
+    STATS_ADD(&encInfo->stats, bytes_read, encInfo->image_copied);
+    encInfo->image_pos = 0;
+    encInfo->src_image_data = encInfo->image_buffer;
+    return e_success;
+}
+
+/*Function to map source image and stego image into memory*/
+Status map_src_image(EncodeInfo *encInfo)
+{
+    struct stat st;
+    int src_fd = fileno(encInfo->fptr_src_image);
+    int stego_fd = fileno(encInfo->fptr_stego_image);
+
+    if (fstat(src_fd, &st) != 0)
+    {
+        perror("fstat");
+        return e_failure;
+    }
+    encInfo->image_file_size = st.st_size;
+
+    if (encInfo->image_file_size < BMP_HEADER_SIZE)
+    {
+        fprintf(stderr, "ERROR: %s is too small to be a carrier image\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+
+    encInfo->src_image_map = mmap(NULL, encInfo->image_file_size, PROT_READ, MAP_SHARED, src_fd, 0);
+    if (encInfo->src_image_map == MAP_FAILED)
+    {
+        encInfo->src_image_map = NULL;
+        perror("mmap");
+        return e_failure;
+    }
+
+    //stego image gets the final size up front so it can be mapped
+    if (ftruncate(stego_fd, encInfo->image_file_size) != 0)
+    {
+        perror("ftruncate");
+        return e_failure;
+    }
+
+    encInfo->image_buffer = mmap(NULL, encInfo->image_file_size, PROT_READ | PROT_WRITE, MAP_SHARED, stego_fd, 0);
+    if (encInfo->image_buffer == MAP_FAILED)
+    {
+        encInfo->image_buffer = NULL;
+        perror("mmap");
+        return e_failure;
+    }
+
+    //fstat, two mmaps and ftruncate
+    STATS_ADD(&encInfo->stats, syscalls, 4);
+
+    //nothing copied yet, bytes are pulled from src as phases reach them
+    encInfo->image_pos = 0;
+    encInfo->image_copied = 0;
+    encInfo->src_image_data = encInfo->src_image_map;
+    return e_success;
+}
+
+/*Function to make the stego image a reflink clone of the source, a plain copy where that is not supported*/
+static Status clone_src_image(EncodeInfo *encInfo, long size)
+{
+    int src_fd = fileno(encInfo->fptr_src_image);
+    int stego_fd = fileno(encInfo->fptr_stego_image);
+    loff_t src_off = 0, dest_off = 0;
+    ssize_t ret;
+
+    //shared extents, no data is read or written
+    STATS_ADD(&encInfo->stats, syscalls, 1);
+    if (ioctl(stego_fd, FICLONE, src_fd) == 0)
+        return e_success;
+
+    //copy_file_range still lets the filesystem share or copy the blocks itself
+    while (src_off < size)
+    {
+        ret = copy_file_range(src_fd, &src_off, stego_fd, &dest_off, size - src_off, 0);
+        STATS_ADD(&encInfo->stats, syscalls, 1);
+        if (ret <= 0)
+        {
+            perror("copy_file_range");
+            return e_failure;
+        }
+        STATS_ADD(&encInfo->stats, bytes_read, ret);
+        STATS_ADD(&encInfo->stats, bytes_written, ret);
+    }
+    return e_success;
+}
+
+/*Function to map the stego image, already holding the carrier bytes, to be patched*/
+Status map_patch_image(EncodeInfo *encInfo)
+{
+    struct stat st, stego_st;
+
+    if (fstat(fileno(encInfo->fptr_src_image), &st) != 0)
+    {
+        perror("fstat");
+        return e_failure;
+    }
+    encInfo->image_file_size = st.st_size;
+
+    if (encInfo->image_file_size < BMP_HEADER_SIZE)
+    {
+        fprintf(stderr, "ERROR: %s is too small to be a carrier image\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    if (encInfo->opts.patch == PATCH_CLONE && clone_src_image(encInfo, encInfo->image_file_size) != e_success)
+        return e_failure;
+
+    //in place patches the carrier itself, any other file would be mapped at the carrier's size
+    if (fstat(fileno(encInfo->fptr_stego_image), &stego_st) != 0)
+    {
+        perror("fstat");
+        return e_failure;
+    }
+    if (encInfo->opts.patch == PATCH_IN_PLACE && (stego_st.st_dev != st.st_dev || stego_st.st_ino != st.st_ino))
+    {
+        fprintf(stderr, "ERROR: %s is not the carrier %s, in place encoding patches the carrier itself\n",
+                encInfo->stego_image_fname, encInfo->src_image_fname);
+        return e_failure;
+    }
+    if (stego_st.st_size < encInfo->image_file_size)
+    {
+        fprintf(stderr, "ERROR: %s is smaller than the carrier %s\n", encInfo->stego_image_fname, encInfo->src_image_fname);
+        return e_failure;
+    }
+
+    //only pages embedding touches are read in, only dirty ones are written back
+    encInfo->image_buffer = mmap(NULL, encInfo->image_file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(encInfo->fptr_stego_image), 0);
+    if (encInfo->image_buffer == MAP_FAILED)
+    {
+        encInfo->image_buffer = NULL;
+        perror("mmap");
+        return e_failure;
+    }
+
+    //fstat of both images and mmap
+    STATS_ADD(&encInfo->stats, syscalls, 3);
+
+    //source and stego image are the same bytes, there is never anything to copy
+    encInfo->patching = 1;
+    encInfo->image_pos = 0;
+    encInfo->image_copied = encInfo->image_file_size;
+    encInfo->src_image_map = encInfo->image_buffer;
+    encInfo->src_image_data = encInfo->image_buffer;
+    return e_success;
+}
+
+/*Function to copy src data into image buffer up to file offset end*/
+static void copy_src_until(EncodeInfo *encInfo, long end)
+{
+    //only the mapped stego image starts out empty
+    if (end > encInfo->image_copied)
+    {
+        memcpy(encInfo->image_buffer + encInfo->image_copied, encInfo->src_image_map + encInfo->image_copied, end - encInfo->image_copied);
+        STATS_ADD(&encInfo->stats, bytes_read, end - encInfo->image_copied);
+        STATS_ADD(&encInfo->stats, bytes_written, end - encInfo->image_copied);
+        encInfo->image_copied = end;
+    }
+}
+
+/*Function to make sure image buffer holds src data for next len carrier bytes*/
+Status prepare_image_span(EncodeInfo *encInfo, long len)
+{
+    long end = encInfo->image_pos + len;
+
+    if (end > encInfo->layout.capacity)
+        return e_failure;
+
+    //pipelined head: header fields must fit, the payload never comes this way
+    if (encInfo->pipelined)
+        return carrier_phys_offset(&encInfo->layout, end) <= encInfo->image_copied ? e_success : e_failure;
+
+    //padding and alpha up to the next carrier byte come along untouched
+    copy_src_until(encInfo, carrier_phys_offset(&encInfo->layout, end));
+    return e_success;
+}
+
+/*Function to get extension of secret file*/
+Status get_secret_file_extn(const char *fname, char *extn)
+{
+    const char *base = strrchr(fname, '/');
+    const char *dot;
+
+    //only look at the file name, directories may contain dots
+    base = base ? base + 1 : fname;
+    dot = strrchr(base, '.');
+
+    //files without extension are stored with an empty one
+    if (dot == NULL || dot == base)
+    {
+        extn[0] = '\0';
+        return e_success;
+    }
+    if (strlen(dot) > MAX_FILE_SUFFIX)
+        return e_failure;
+
+    strcpy(extn, dot);
     return e_success;
 }
 
 /*Function to validate input arguments for encoding from user*/
 Status read_and_validate_encode_args(char *argv[] , EncodeInfo *encInfo)
 {
-    //check if original .bmp file passed or not
-    if(strcmp(strstr(argv[2],".") , ".bmp") == 0)
+    const char *stego_name;
+
+    //check if original .bmp, .ppm or .pgm file passed or not
+    stego_name = carrier_stego_name(argv[2]);
+    if(stego_name != NULL)
     {
         encInfo->src_image_fname = argv[2];
     }
     else
         return e_failure;
 
-    //check if secret file passed or not
-    if(strcmp(strstr(argv[3],".") , ".txt") == 0)
+    //check if secret file passed or not, any file type can be hidden
+    if(argv[3] != NULL && get_secret_file_extn(argv[3], encInfo->extn_secret_file) == e_success)
     {
         encInfo->secret_fname = argv[3];
     }
     else
         return e_failure;
 
+    //in place the carrier is the stego image, there is no other file
+    if(encInfo->opts.patch == PATCH_IN_PLACE)
+    {
+        if(argv[4] != NULL && strcmp(argv[4], argv[2]) != 0)
+            return e_failure;
+        encInfo->stego_image_fname = argv[2];
+        return e_success;
+    }
+
     //check if image file to encode data passed or not
     //if not passed create a file 
     if(argv[4] != NULL)
@@ -104,7 +357,7 @@ Status read_and_validate_encode_args(char *argv[] , EncodeInfo *encInfo)
     }
     else
     {
-        encInfo->stego_image_fname = "stego.bmp";
+        encInfo->stego_image_fname = (char *)stego_name;
     }
     return e_success;
 }
@@ -112,19 +365,101 @@ Status read_and_validate_encode_args(char *argv[] , EncodeInfo *encInfo)
 /*Function to check capacity of input bmp file*/
 Status check_capacity(EncodeInfo *encInfo)
 {
-    //call function to get input .bmp image size and store in structure member
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
+
+    //multi bit payloads need the v2 header to record the bit count
+    encInfo->lsb_bits = encInfo->opts.lsb_bits ? encInfo->opts.lsb_bits : 1;
+    if (encInfo->lsb_bits != 1 && encInfo->lsb_bits != 2 && encInfo->lsb_bits != 4)
+    {
+        fprintf(stderr, "ERROR: %d lsb bits per byte is not supported\n", encInfo->lsb_bits);
+        return e_failure;
+    }
+    encInfo->header_flags = encInfo->lsb_bits > 1 ? (uint)encInfo->lsb_bits : 0;
 
     //call function to get input secret file size and store in structure member
-    encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+    //a secret held in memory comes with its size already set
+    if (encInfo->secret_buffer == NULL)
+    {
+        encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+        STATS_ADD(&encInfo->stats, syscalls, 1);
+    }
+    //compressed payload is made block by block in the data phase, its size is not known yet
+    if (encInfo->opts.compress)
+    {
+        encInfo->header_flags |= FLAG_LZ;
+        encInfo->raw_secret_size = encInfo->size_secret_file;
+    }
+    if (encInfo->opts.crc)
+        encInfo->header_flags |= FLAG_CRC32C;
+    if (encInfo->archive)
+        encInfo->header_flags |= FLAG_ARCHIVE;
+    if (encInfo->shard.count)
+        encInfo->header_flags |= FLAG_SHARD;
+    if (encInfo->opts.encrypt)
+        encInfo->header_flags |= FLAG_CHACHA20;
+    if (encInfo->opts.scatter)
+    {
+        //block order comes from the key
+        if (!encInfo->opts.encrypt)
+        {
+            fprintf(stderr, "ERROR: scattering the payload needs a key\n");
+            return e_failure;
+        }
+        encInfo->header_flags |= FLAG_SCATTER;
+    }
+
+    //find the usable pixel bytes, padding and alpha are never touched
+    if (carrier_parse_layout((const unsigned char *)encInfo->src_image_data, encInfo->pipelined ? encInfo->image_copied : encInfo->image_file_size,
+                             encInfo->image_file_size, &encInfo->layout) != e_success)
+    {
+        fprintf(stderr, "ERROR: %s is not a 24 or 32 bit uncompressed bmp or an 8 bit binary ppm/pgm image\n", encInfo->src_image_fname ? encInfo->src_image_fname : "image");
+        return e_failure;
+    }
+    encInfo->image_capacity = encInfo->layout.capacity;
+
+    //carriers the original format could not handle get the v2 header
+    encInfo->v2_header = encInfo->header_flags || !carrier_is_legacy(&encInfo->layout);
 
     //logic to check if input .bmp image file is capable to store secret file data
-    if(encInfo->image_capacity > ((2 + 4 + 4 + 4 + encInfo->size_secret_file) * 8))
+    //a compressed secret is checked block by block as it is embedded, only the header has to fit now
+    if (encInfo->header_flags & FLAG_LZ)
+        return encode_payload_capacity(encInfo) >= 0 ? e_success : e_failure;
+    if(encInfo->size_secret_file <= encode_payload_capacity(encInfo))
         return e_success;
     else
         return e_failure;
 }
 
+/*Function to get the largest secret that fits in the carrier next to the header*/
+long encode_payload_capacity(EncodeInfo *encInfo)
+{
+    long header_size, avail;
+
+    //magic string, extn size, extn and file size go in front of the data
+    header_size = strlen(MAGIC_STRING) + 4 + strlen(encInfo->extn_secret_file) + 4;
+    if (encInfo->v2_header)
+        header_size += 4;
+    if (encInfo->header_flags & FLAG_LZ)
+        header_size += 4;
+    if (encInfo->header_flags & FLAG_CRC32C)
+        header_size += 4;
+    if (encInfo->header_flags & FLAG_CHACHA20)
+        header_size += CHACHA20_NONCE_SIZE;
+    if (encInfo->header_flags & FLAG_SHARD)
+        header_size += SHARD_HEADER_SIZE;
+
+    //header takes 8 carrier bytes per byte, the image keeps at least one byte spare
+    avail = (long)encInfo->layout.capacity - header_size * 8 - 1;
+    if (avail < 0)
+        return -1;
+
+    //scattered payload only goes into whole blocks
+    if (encInfo->header_flags & FLAG_SCATTER)
+        avail = avail / SCATTER_BLOCK * SCATTER_BLOCK;
+
+    //payload takes 8 / lsb_bits carrier bytes per byte
+    return avail / (8 / encInfo->lsb_bits);
+}
+
 /*Function to get file size*/
 uint get_file_size(FILE *fptr)
 {
@@ -136,221 +471,1042 @@ uint get_file_size(FILE *fptr)
 }
 
 /*Function to copy input bmp file header to stego image */
-Status copy_bmp_header(FILE *fptr_src_image , FILE *fptr_dest_image )
+Status copy_bmp_header(EncodeInfo *encInfo)
 {
-    char str[54];
+    long header_size = encInfo->layout.data_offset;
 
-    //seek 0th position
-    fseek(fptr_src_image, 0, SEEK_SET);
+    //embedding starts at the first carrier byte after the header
+    encInfo->image_pos = 0;
 
-    //read 54 byte bmp header data from input file
-    fread(str, 54, 1, fptr_src_image);
-
-    //write 54 byte bmp header data into stego image
-    fwrite(str, 54, 1, fptr_dest_image);
+    if (encInfo->src_image_map)
+    {
+        //header lands in the mapped stego image or output buffer
+        copy_src_until(encInfo, header_size);
+        return e_success;
+    }
 
+    //write bmp header, colour masks and palette included, into stego image
+    if (fwrite(encInfo->image_buffer, header_size, 1, encInfo->fptr_stego_image) != 1)
+        return e_failure;
+    STATS_ADD(&encInfo->stats, syscalls, 1);
+    STATS_ADD(&encInfo->stats, bytes_written, header_size);
     return e_success;
 }
 
-/*Function to encode magic string*/
-Status encode_magic_string(char *magic_string, EncodeInfo *encInfo)
+/*Function to embed size bytes at bits per carrier byte from image_pos*/
+static Status embed_at_image_pos(const char *data, long size, int bits, EncodeInfo *encInfo)
 {
-    encode_data_to_image(magic_string, 2, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+    long carrier_len = size * (8 / bits);
+
+    //check the data fits in the image buffer
+    if (prepare_image_span(encInfo, carrier_len) != e_success)
+        return e_failure;
+
+    carrier_embed(&encInfo->layout, encInfo->image_buffer, 0, encInfo->image_pos, data, size, bits);
+    STATS_ADD(&encInfo->stats, carrier_bytes, carrier_len);
+    encInfo->image_pos += carrier_len;
     return e_success;
 }
 
 /*Function to encode data to stego image*/
-Status encode_data_to_image(char *data, int size, FILE *fptr_src_image, FILE *fptr_stego_image, EncodeInfo *encInfo)
+Status encode_data_to_image(char *data, int size, EncodeInfo *encInfo)
 {
-    for(int i = 0 ; i < size ; i++)
+    //encode all data bytes into lsb of next 8 * size carrier bytes
+    return embed_at_image_pos(data, size, 1, encInfo);
+}
+
+/*Function to checksum and encrypt one payload block, returns the bytes to embed*/
+static const char *seal_payload_block(EncodeInfo *encInfo, const char *data, long count, long offset, char *scratch, uint32_t *crc)
+{
+    //secret may be a caller buffer, the ciphertext goes to scratch
+    if (encInfo->header_flags & FLAG_CHACHA20)
     {
-        //read 8 byte data at a time from input bmp file
-        fread(encInfo->image_data, 8, 1, fptr_src_image);
+        chacha20_xor(&encInfo->cipher, offset, scratch, data, count);
+        data = scratch;
+    }
+
+    //crc is of the bytes as embedded, the ciphertext when encrypted, so it tells nothing about the secret
+    if (encInfo->header_flags & FLAG_CRC32C)
+        *crc = crc32c_update(*crc, data, count);
+    return data;
+}
+
+/*Function to encode payload bytes at lsb_bits bits per carrier byte*/
+Status encode_payload_to_image(char *data, long size, EncodeInfo *encInfo)
+{
+    char scratch[PAYLOAD_BLOCK_SIZE];
+    long stride = 8 / encInfo->lsb_bits;
+
+    if (!(encInfo->header_flags & (FLAG_CRC32C | FLAG_CHACHA20 | FLAG_SCATTER)))
+        return embed_at_image_pos(data, size, encInfo->lsb_bits, encInfo);
 
-        //encode data to be hidden into lsb of data read from input bmp file 
-        encode_byte_to_lsb(data[i], encInfo->image_data);
+    //crc and cipher of each block right before its embed, the data is read from memory once
+    while (size > 0)
+    {
+        long count = size < PAYLOAD_BLOCK_SIZE ? size : PAYLOAD_BLOCK_SIZE;
+        const char *block;
 
-        //write the encode 8 bytes into stego image
-        fwrite(encInfo->image_data, 8, 1, fptr_stego_image);
+        //scattered payload: image_pos runs through the stream, each run stops at its carrier block end
+        if (encInfo->header_flags & FLAG_SCATTER)
+        {
+            if (count > scatter_run(&encInfo->scatter, encInfo->image_pos) / stride)
+                count = scatter_run(&encInfo->scatter, encInfo->image_pos) / stride;
+            block = seal_payload_block(encInfo, data, count, encInfo->payload_pos, scratch, &encInfo->payload_crc);
+            carrier_embed(&encInfo->layout, encInfo->image_buffer, 0, scatter_pos(&encInfo->scatter, encInfo->image_pos), block, count, encInfo->lsb_bits);
+            STATS_ADD(&encInfo->stats, carrier_bytes, count * stride);
+            encInfo->image_pos += count * stride;
+        }
+        else
+        {
+            block = seal_payload_block(encInfo, data, count, encInfo->payload_pos, scratch, &encInfo->payload_crc);
+            if (embed_at_image_pos(block, count, encInfo->lsb_bits, encInfo) != e_success)
+                return e_failure;
+        }
+        encInfo->payload_pos += count;
+        data += count;
+        size -= count;
     }
+    return e_success;
+}
+
+/*Function to encode 32 bit value into next 32 carrier bytes*/
+static Status encode_word_to_image(uint value, EncodeInfo *encInfo)
+{
+    char bytes[4];
+
+    //most significant byte first, so the word lands most significant bit first
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+    return embed_at_image_pos(bytes, 4, 1, encInfo);
+}
+
+/*Function to encode magic string*/
+Status encode_magic_string(char *magic_string, EncodeInfo *encInfo)
+{
+    if (encode_data_to_image(magic_string, strlen(magic_string), encInfo) != e_success)
+        return e_failure;
+
+    //v2 images carry the flags word right after the magic string
+    if (strcmp(magic_string, MAGIC_STRING_V2) != 0)
+        return e_success;
+    return encode_word_to_image(encInfo->header_flags, encInfo);
 }
 
 /*Function to encode secret file extension size*/
-Status encode_secret_file_extn_size(int size, FILE *fptr_src_image, FILE *fptr_stego_image)
+Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
+{
+    //store secret file extn size into next 32 carrier bytes
+    return encode_word_to_image(size, encInfo);
+}
+
+/*Function to store secret file extension into stego image*/
+Status encode_secret_file_extn(char *file_extn, EncodeInfo *encInfo)
+{
+    return encode_data_to_image(file_extn, strlen(file_extn), encInfo);
+}
+
+/*Function to encode secret file size into stego image*/
+Status encode_secret_file_size(int size, EncodeInfo *encInfo)
 {
-    char str[32];
-    //read 32 bytes from input bmp source image
-    fread(str, 32, 1, fptr_src_image);
+    //compressed payload: stored size is only known after the data phase, keep its place
+    encInfo->size_pos = encInfo->image_pos;
+    if (encInfo->header_flags & FLAG_LZ)
+        size = 0;
+
+    //encode secret file size into next 32 carrier bytes
+    if (encode_word_to_image(size, encInfo) != e_success)
+        return e_failure;
+
+    //compressed payload: original size after the stored size
+    if ((encInfo->header_flags & FLAG_LZ) && encode_word_to_image(encInfo->raw_secret_size, encInfo) != e_success)
+        return e_failure;
 
-    //store secret file extn size into these 32 bytes
-    encode_size_to_lsb(size,str);
+    //crc is only known after the data phase, keep its place
+    encInfo->payload_crc = 0;
+    encInfo->payload_pos = 0;
+    if (encInfo->header_flags & FLAG_CRC32C)
+    {
+        encInfo->crc_pos = encInfo->image_pos;
+        if (encode_word_to_image(0, encInfo) != e_success)
+            return e_failure;
+    }
+
+    //fresh nonce for every image, the same key can be used again
+    if (encInfo->header_flags & FLAG_CHACHA20)
+    {
+        unsigned char nonce[CHACHA20_NONCE_SIZE];
 
-    //write these encoded 32 bytes into stego image
-    fwrite(str, 32, 1, fptr_stego_image);
+        if (getrandom(nonce, sizeof(nonce), 0) != sizeof(nonce))
+            return e_failure;
+        chacha20_init(&encInfo->cipher, encInfo->opts.key, nonce);
+        if (encode_data_to_image((char *)nonce, sizeof(nonce), encInfo) != e_success)
+            return e_failure;
+    }
+
+    //shard of a larger file: where it goes and which set it belongs to
+    if (encInfo->header_flags & FLAG_SHARD)
+    {
+        if (encode_word_to_image(encInfo->shard.index, encInfo) != e_success ||
+            encode_word_to_image(encInfo->shard.count, encInfo) != e_success ||
+            encode_word_to_image(encInfo->shard.id, encInfo) != e_success ||
+            encode_word_to_image(encInfo->shard.offset, encInfo) != e_success ||
+            encode_word_to_image(encInfo->shard.total, encInfo) != e_success)
+            return e_failure;
+    }
     return e_success;
 }
 
-/*Function to encode size to lsb*/
-Status encode_size_to_lsb(int size, char *image_buffer)
+/*Function to fill in a header word left empty by encode_secret_file_size*/
+static Status patch_header_word(EncodeInfo *encInfo, long at, uint value)
+{
+    long pos = encInfo->image_pos;
+    Status ret;
+
+    //header carrier bytes are still in the image buffer in every mode
+    encInfo->image_pos = at;
+    ret = encode_word_to_image(value, encInfo);
+    encInfo->image_pos = pos;
+    return ret;
+}
+
+/*Function to fill in the crc field left empty by encode_secret_file_size*/
+static Status encode_payload_crc(EncodeInfo *encInfo)
+{
+    return patch_header_word(encInfo, encInfo->crc_pos, encInfo->payload_crc);
+}
+
+/* Slice of payload handed to one worker */
+typedef struct
+{
+    EncodeInfo *encInfo;
+    long carrier_off;
+    const char *data;
+    long size;
+    long payload_off;       // offset of data in the payload, keystream offset
+    uint32_t crc;           // CRC32C of the slice data
+} EmbedSlice;
+
+/*Function run by a worker to embed one slice*/
+static void embed_slice_task(void *arg)
 {
-    //logic to encode size into lsb of data read from input bmp file
-    unsigned int mask = 1 << 31, i;
+    EmbedSlice *slice = arg;
+    EncodeInfo *encInfo = slice->encInfo;
+    char scratch[PAYLOAD_BLOCK_SIZE];
+    long carrier_len = slice->size * (8 / encInfo->lsb_bits);
+    long pos = slice->carrier_off, done = 0;
+
+    //mapped stego image or output buffer: each worker pulls in its own src bytes
+    //a scattered payload had the whole image copied up front, a patched one needs none
+    if (encInfo->src_image_map && !encInfo->patching && !(encInfo->header_flags & FLAG_SCATTER))
+    {
+        long start = carrier_phys_offset(&encInfo->layout, slice->carrier_off);
+        long end = carrier_phys_offset(&encInfo->layout, slice->carrier_off + carrier_len);
+
+        memcpy(encInfo->image_buffer + start, encInfo->src_image_map + start, end - start);
+        STATS_ADD(&encInfo->stats, bytes_read, end - start);
+        STATS_ADD(&encInfo->stats, bytes_written, end - start);
+    }
 
-    for(i = 0 ; i < 32 ; i++)
+    if (!(encInfo->header_flags & (FLAG_CRC32C | FLAG_CHACHA20 | FLAG_SCATTER)))
     {
-        image_buffer[i] = (image_buffer[i] & 0xFE) | ((size & mask) >> (31 - i));
-        mask = mask >> 1;
+        carrier_embed(&encInfo->layout, encInfo->image_buffer, 0, slice->carrier_off, slice->data, slice->size, encInfo->lsb_bits);
+        return;
+    }
+
+    //crc and cipher of each block right before its embed, slice crcs are combined in order later
+    slice->crc = 0;
+    while (done < slice->size)
+    {
+        long count = slice->size - done < PAYLOAD_BLOCK_SIZE ? slice->size - done : PAYLOAD_BLOCK_SIZE;
+        long dest = pos;
+        const char *block;
+
+        //scattered payload: pos is the stream offset, runs stop at carrier block ends
+        if (encInfo->header_flags & FLAG_SCATTER)
+        {
+            if (count > scatter_run(&encInfo->scatter, pos) / (8 / encInfo->lsb_bits))
+                count = scatter_run(&encInfo->scatter, pos) / (8 / encInfo->lsb_bits);
+            dest = scatter_pos(&encInfo->scatter, pos);
+        }
+        block = seal_payload_block(encInfo, slice->data + done, count, slice->payload_off + done, scratch, &slice->crc);
+        carrier_embed(&encInfo->layout, encInfo->image_buffer, 0, dest, block, count, encInfo->lsb_bits);
+        pos += count * (8 / encInfo->lsb_bits);
+        done += count;
     }
 }
 
-/*Function to encode byte to lsb*/
-Status encode_byte_to_lsb(char data, char *image_buffer)
+/*Function to encode data with the payload split across the thread pool*/
+Status encode_data_parallel(char *data, long size, EncodeInfo *encInfo)
 {
-    //logic to encode data into lsb of data read from input bmp file
-    unsigned int mask = 0x80, i;
+    int nslices = threadpool_size(encInfo->pool);
+    EmbedSlice slices[nslices];
+    long per_slice = (size + nslices - 1) / nslices;
+    long stride = 8 / encInfo->lsb_bits;
+    long off = 0;
+    int i;
 
-    for(i = 0 ; i < 8 ; i++)
+    //catch up on src bytes before this run, then check it fits
+    if (prepare_image_span(encInfo, 0) != e_success)
+        return e_failure;
+    if (encInfo->image_pos + size * stride > encInfo->layout.capacity)
+        return e_failure;
+
+    //payload byte i always lands at image_pos + stride * i, slices are independent
+    for(i = 0 ; i < nslices && off < size ; i++)
     {
-        image_buffer[i] = ((image_buffer[i] & 0xFE) | ((data & mask) >> (7 - i)));
-        mask = mask >> 1;
+        slices[i].encInfo = encInfo;
+        slices[i].carrier_off = encInfo->image_pos + off * stride;
+        slices[i].data = data + off;
+        slices[i].payload_off = encInfo->payload_pos + off;
+        slices[i].size = size - off < per_slice ? size - off : per_slice;
+        off += slices[i].size;
+
+        if (threadpool_submit(encInfo->pool, embed_slice_task, &slices[i]) != e_success)
+            embed_slice_task(&slices[i]);
     }
+    threadpool_wait(encInfo->pool);
+
+    //crc of the run from the crcs of its slices
+    if (encInfo->header_flags & FLAG_CRC32C)
+    {
+        int used = i;
+
+        for (i = 0 ; i < used ; i++)
+            encInfo->payload_crc = crc32c_combine(encInfo->payload_crc, slices[i].crc, slices[i].size);
+    }
+
+    STATS_ADD(&encInfo->stats, carrier_bytes, size * stride);
+    encInfo->payload_pos += size;
+    encInfo->image_pos += size * stride;
+    if (encInfo->src_image_map && !encInfo->patching && !(encInfo->header_flags & FLAG_SCATTER))
+        encInfo->image_copied = carrier_phys_offset(&encInfo->layout, encInfo->image_pos);
+    return e_success;
 }
 
-/*Function to store secret file extension into stego image*/
-Status encode_secret_file_extn(char *file_extn, EncodeInfo *encInfo)
+/* One block of the image on its way through the pipeline */
+typedef struct
+{
+    char *buf;              // image bytes from file offset off
+    long buf_size;
+    long off;
+    long len;
+    long pos;               // logical carrier offset of the first carrier byte
+    char *data;             // payload bytes embedded in this block
+    char *secret;           // data read from the secret file lands here
+    long secret_size;
+    long count;             // payload bytes
+} PipeBlock;
+
+/* Stages and the rings between them: free -> read -> embedded -> free */
+typedef struct
+{
+    EncodeInfo *encInfo;
+    PipeBlock blocks[RING_SLOTS];
+    Ring free;
+    Ring read;
+    Ring embedded;
+    long start;             // logical carrier offset of block 0
+    long nblocks;
+    int failed;             // any stage failed, later blocks only move along
+} EncodePipe;
+
+/*Function to work out file span and payload of block k*/
+static void pipe_block_span(EncodePipe *pipe, long k, PipeBlock *block)
 {
-    encode_data_to_image(file_extn, strlen(file_extn), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+    EncodeInfo *encInfo = pipe->encInfo;
+    long stride = 8 / encInfo->lsb_bits;
+    long end = pipe->start + (k + 1) * PIPE_BLOCK_SIZE;
+    long first, last;
+
+    //blocks tile the file from the first payload carrier byte, the last one runs to the end of file
+    block->pos = pipe->start + k * PIPE_BLOCK_SIZE;
+    block->off = carrier_phys_offset(&encInfo->layout, block->pos);
+    if (k == pipe->nblocks - 1 || end >= encInfo->layout.capacity)
+        block->len = encInfo->image_file_size - block->off;
+    else
+        block->len = carrier_phys_offset(&encInfo->layout, end) - block->off;
+
+    //block size is a multiple of the stride, no payload byte straddles two blocks
+    first = k * (PIPE_BLOCK_SIZE / stride);
+    last = first + PIPE_BLOCK_SIZE / stride;
+    if (first > encInfo->size_secret_file)
+        first = encInfo->size_secret_file;
+    if (last > encInfo->size_secret_file)
+        last = encInfo->size_secret_file;
+    block->count = last - first;
+    block->data = encInfo->secret_buffer ? (char *)encInfo->secret_buffer + first : block->secret;
+}
+
+/*Function to pread len bytes at off, short reads are retried*/
+static Status pipe_pread(EncodeInfo *encInfo, int fd, char *buf, long len, long off)
+{
+    ssize_t ret;
+
+    while (len > 0)
+    {
+        ret = pread(fd, buf, len, off);
+        STATS_ADD(&encInfo->stats, syscalls, 1);
+        if (ret <= 0)
+            return e_failure;
+        STATS_ADD(&encInfo->stats, bytes_read, ret);
+        buf += ret;
+        off += ret;
+        len -= ret;
+    }
     return e_success;
 }
 
-/*Function to encode secret file size into stego image*/
-Status encode_secret_file_size(int size, EncodeInfo *encInfo)
+/*Function run by the reader stage: carrier block and its payload bytes*/
+static void *pipe_reader(void *arg)
+{
+    EncodePipe *pipe = arg;
+    EncodeInfo *encInfo = pipe->encInfo;
+    long stride = 8 / encInfo->lsb_bits;
+    long k;
+
+    for (k = 0; k < pipe->nblocks; k++)
+    {
+        int slot = ring_pop(&pipe->free);
+        PipeBlock *block = &pipe->blocks[slot];
+
+        if (!__atomic_load_n(&pipe->failed, __ATOMIC_RELAXED))
+        {
+            pipe_block_span(pipe, k, block);
+
+            //buffers grow to the largest block once and are reused
+            if (block->len > block->buf_size)
+            {
+                free(block->buf);
+                block->buf_size = block->len;
+                block->buf = malloc(block->buf_size);
+            }
+            if (encInfo->secret_buffer == NULL && block->secret == NULL)
+            {
+                block->secret_size = PIPE_BLOCK_SIZE / stride;
+                block->data = block->secret = malloc(block->secret_size);
+            }
+            if (block->buf == NULL || (encInfo->secret_buffer == NULL && block->secret == NULL) ||
+                pipe_pread(encInfo, fileno(encInfo->fptr_src_image), block->buf, block->len, block->off) != e_success ||
+                (encInfo->secret_buffer == NULL &&
+                 pipe_pread(encInfo, fileno(encInfo->fptr_secret), block->secret, block->count, k * (PIPE_BLOCK_SIZE / stride)) != e_success))
+                __atomic_store_n(&pipe->failed, 1, __ATOMIC_RELAXED);
+        }
+        ring_push(&pipe->read, slot);
+    }
+    return NULL;
+}
+
+/*Function run by the writer stage: embedded blocks go to their own offsets*/
+static void *pipe_writer(void *arg)
 {
-    char str[32];
-    //read 32 byte data from source bmp file
-    fread(str, 32, 1, encInfo->fptr_src_image);
+    EncodePipe *pipe = arg;
+    EncodeInfo *encInfo = pipe->encInfo;
+    int stego_fd = fileno(encInfo->fptr_stego_image);
+    long k;
 
-    //encode secret file size into these 32 byte data
-    encode_size_to_lsb(size, str);
+    for (k = 0; k < pipe->nblocks; k++)
+    {
+        int slot = ring_pop(&pipe->embedded);
+        PipeBlock *block = &pipe->blocks[slot];
+        long done = 0;
+        ssize_t ret;
+
+        while (!__atomic_load_n(&pipe->failed, __ATOMIC_RELAXED) && done < block->len)
+        {
+            ret = pwrite(stego_fd, block->buf + done, block->len - done, block->off + done);
+            STATS_ADD(&encInfo->stats, syscalls, 1);
+            if (ret <= 0)
+                __atomic_store_n(&pipe->failed, 1, __ATOMIC_RELAXED);
+            else
+            {
+                STATS_ADD(&encInfo->stats, bytes_written, ret);
+                done += ret;
+            }
+        }
+        ring_push(&pipe->free, slot);
+    }
+    return NULL;
+}
 
-    //write these encoded 32 bytes into stego image
-    fwrite(str, 32, 1, encInfo->fptr_stego_image);
+/*Function to embed the payload with reads, embedding and writes overlapping*/
+Status encode_data_pipelined(EncodeInfo *encInfo)
+{
+    EncodePipe *pipe = calloc(1, sizeof(EncodePipe));
+    char scratch[PAYLOAD_BLOCK_SIZE];
+    long stride = 8 / encInfo->lsb_bits;
+    pthread_t reader, writer;
+    Status ret;
+    long k;
+    int i;
+
+    if (pipe == NULL)
+        return e_failure;
+    if (encInfo->image_pos + encInfo->size_secret_file * stride > encInfo->layout.capacity)
+    {
+        free(pipe);
+        return e_failure;
+    }
+
+    //head up to the payload stays in image_buffer, the crc still has to go in there
+    pipe->encInfo = encInfo;
+    pipe->start = encInfo->image_pos;
+    pipe->nblocks = (encInfo->layout.capacity - pipe->start + PIPE_BLOCK_SIZE - 1) / PIPE_BLOCK_SIZE;
+    encInfo->pipe_start = carrier_phys_offset(&encInfo->layout, pipe->start);
+    if (pipe->nblocks == 0 && encInfo->pipe_start < encInfo->image_file_size)
+        pipe->nblocks = 1;
+
+    ring_init(&pipe->free);
+    ring_init(&pipe->read);
+    ring_init(&pipe->embedded);
+    for (i = 0; i < RING_SLOTS; i++)
+        ring_push(&pipe->free, i);
+
+    if (pthread_create(&reader, NULL, pipe_reader, pipe) != 0)
+    {
+        free(pipe);
+        return e_failure;
+    }
+    if (pthread_create(&writer, NULL, pipe_writer, pipe) != 0)
+    {
+        //nothing gets written, the reader runs out of blocks and stops
+        __atomic_store_n(&pipe->failed, 1, __ATOMIC_RELAXED);
+        for (k = 0; k < pipe->nblocks; k++)
+            ring_push(&pipe->free, ring_pop(&pipe->read));
+        pthread_join(reader, NULL);
+        free(pipe);
+        return e_failure;
+    }
+
+    //embed stage runs here, blocks come and go in file order
+    for (k = 0; k < pipe->nblocks; k++)
+    {
+        int slot = ring_pop(&pipe->read);
+        PipeBlock *block = &pipe->blocks[slot];
+        long done = 0;
+
+        //crc and cipher per payload block right before its embed, as in the serial path
+        while (!__atomic_load_n(&pipe->failed, __ATOMIC_RELAXED) && done < block->count)
+        {
+            long count = block->count - done < PAYLOAD_BLOCK_SIZE ? block->count - done : PAYLOAD_BLOCK_SIZE;
+            const char *sealed = seal_payload_block(encInfo, block->data + done, count, encInfo->payload_pos, scratch, &encInfo->payload_crc);
+
+            carrier_embed(&encInfo->layout, block->buf, block->off, block->pos + done * stride, sealed, count, encInfo->lsb_bits);
+            STATS_ADD(&encInfo->stats, carrier_bytes, count * stride);
+            encInfo->payload_pos += count;
+            done += count;
+        }
+        ring_push(&pipe->embedded, slot);
+    }
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+    ret = pipe->failed ? e_failure : e_success;
+    encInfo->image_pos = pipe->start + encInfo->size_secret_file * stride;
+    for (i = 0; i < RING_SLOTS; i++)
+    {
+        free(pipe->blocks[i].buf);
+        free(pipe->blocks[i].secret);
+    }
+    free(pipe);
+    return ret;
+}
+
+/*Function to compress the secret one lz block at a time, each block embedded as soon as it is made*/
+static Status encode_compressed_data(EncodeInfo *encInfo)
+{
+    long capacity = encode_payload_capacity(encInfo);
+    long remaining = encInfo->raw_secret_size;
+    long stored = 0;
+    char *raw = NULL, *packed;
+    Status ret = e_success;
+
+    //one raw and one packed block in memory, whatever the secret size
+    packed = malloc(lz_compress_bound(LZ_BLOCK_SIZE));
+    if (packed == NULL || (encInfo->secret_buffer == NULL && (raw = malloc(LZ_BLOCK_SIZE)) == NULL))
+    {
+        free(packed);
+        return e_failure;
+    }
+
+    //scattered payload: only the block order is needed, the size check is done per block below
+    if ((encInfo->header_flags & FLAG_SCATTER) &&
+        scatter_init(&encInfo->scatter, encInfo->opts.key, encInfo->image_pos, encInfo->layout.capacity, 0) != e_success)
+        ret = e_failure;
+    if (ret == e_success && (encInfo->header_flags & FLAG_SCATTER) && encInfo->src_image_map)
+        copy_src_until(encInfo, encInfo->image_file_size);
+
+    while (ret == e_success && remaining > 0)
+    {
+        long count = remaining < LZ_BLOCK_SIZE ? remaining : LZ_BLOCK_SIZE;
+        const char *src;
+        long packed_size;
+
+        //secret in memory is compressed where it is, no copy
+        if (encInfo->secret_buffer)
+            src = encInfo->secret_buffer + (encInfo->raw_secret_size - remaining);
+        else
+        {
+            if (fread(raw, 1, count, encInfo->fptr_secret) != (size_t)count)
+            {
+                ret = e_failure;
+                break;
+            }
+            STATS_ADD(&encInfo->stats, syscalls, 1);
+            src = raw;
+        }
+        STATS_ADD(&encInfo->stats, bytes_read, count);
+
+        //stored size is unknown until the last block, a secret that does not shrink enough stops here
+        packed_size = lz_compress(src, count, packed);
+        if (stored + packed_size > capacity)
+        {
+            fprintf(stderr, "ERROR: compressed secret does not fit in %s\n", encInfo->src_image_fname ? encInfo->src_image_fname : "the image");
+            ret = e_failure;
+            break;
+        }
+        ret = encode_payload_to_image(packed, packed_size, encInfo);
+        stored += packed_size;
+        remaining -= count;
+    }
+    free(raw);
+    free(packed);
+    if (ret != e_success)
+        return e_failure;
+
+    //every block is in, the header gets the stored size and crc
+    encInfo->size_secret_file = stored;
+    if (patch_header_word(encInfo, encInfo->size_pos, stored) != e_success)
+        return e_failure;
+    if (encInfo->header_flags & FLAG_CRC32C)
+        return encode_payload_crc(encInfo);
     return e_success;
 }
 
 /*Function to store secret file data into stego image*/
 Status encode_secret_file_data(EncodeInfo *encInfo)
 {
+    char chunk[ENCODE_CHUNK_SIZE];
+    char *str = chunk;
+    long chunk_size = ENCODE_CHUNK_SIZE;
+    long remaining = encInfo->size_secret_file;
+    Status ret = e_success;
+
     //seek 0th position of secret file
-    fseek(encInfo->fptr_secret, 0, SEEK_SET);
-    char str[encInfo->size_secret_file];
+    if (encInfo->secret_buffer == NULL)
+    {
+        fseek(encInfo->fptr_secret, 0, SEEK_SET);
+        STATS_ADD(&encInfo->stats, syscalls, 1);
+    }
+
+    //compressed payload is made and embedded one block at a time on this thread
+    if (encInfo->header_flags & FLAG_LZ)
+        return encode_compressed_data(encInfo);
 
-    //read secret file size equivalent data from secret file
-    fread(str, encInfo->size_secret_file, 1, encInfo->fptr_secret);
+    //stdio encode on one thread: reader, embed and writer stages overlap
+    if (encInfo->pipelined)
+    {
+        ret = encode_data_pipelined(encInfo);
+        if (ret == e_success && (encInfo->header_flags & FLAG_CRC32C))
+            ret = encode_payload_crc(encInfo);
+        return ret;
+    }
+
+    //scattered payload lands anywhere after the header, the whole image is copied first
+    if (encInfo->header_flags & FLAG_SCATTER)
+    {
+        if (scatter_init(&encInfo->scatter, encInfo->opts.key, encInfo->image_pos, encInfo->layout.capacity,
+                         remaining * (8 / encInfo->lsb_bits)) != e_success)
+            return e_failure;
+        if (encInfo->src_image_map)
+            copy_src_until(encInfo, encInfo->image_file_size);
+    }
 
-    //encode data read from secert file to stego image file
-    encode_data_to_image(str, strlen(str), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+    if (encInfo->opts.threads > 1 || encInfo->pool)
+    {
+        //set up workers and a chunk large enough to keep all of them busy
+        if (encInfo->pool == NULL)
+        {
+            encInfo->pool = threadpool_create(encInfo->opts.threads);
+            if (encInfo->pool == NULL)
+                return e_failure;
+            encInfo->own_pool = 1;
+        }
+        chunk_size = (long)threadpool_size(encInfo->pool) * PARALLEL_SLICE_SIZE;
+        if (encInfo->secret_buffer == NULL && (str = malloc(chunk_size)) == NULL)
+            return e_failure;
+
+        //tail of the image does not depend on the payload, copy it meanwhile
+        long tail = carrier_phys_offset(&encInfo->layout, encInfo->image_pos + remaining * (8 / encInfo->lsb_bits));
+        if (!(encInfo->header_flags & FLAG_SCATTER) && !encInfo->patching && start_tail_copy(encInfo, tail) != e_success)
+        {
+            if (str != chunk && encInfo->secret_buffer == NULL)
+                free(str);
+            return e_failure;
+        }
+    }
+
+    //read and embed one chunk at a time, memory use does not grow with the secret
+    while (remaining > 0)
+    {
+        size_t count = remaining < chunk_size ? remaining : chunk_size;
+
+        //secret in memory is embedded where it is, no copy
+        if (encInfo->secret_buffer)
+            str = (char *)encInfo->secret_buffer + (encInfo->size_secret_file - remaining);
+        else
+        {
+            if (fread(str, 1, count, encInfo->fptr_secret) != count)
+            {
+                ret = e_failure;
+                break;
+            }
+            STATS_ADD(&encInfo->stats, syscalls, 1);
+        }
+        STATS_ADD(&encInfo->stats, bytes_read, count);
+
+        //encode data read from secert file to stego image file
+        if (encInfo->pool)
+            ret = encode_data_parallel(str, count, encInfo);
+        else
+            ret = encode_payload_to_image(str, count, encInfo);
+        if (ret != e_success)
+            break;
+        remaining -= count;
+    }
+
+    if (encInfo->secret_buffer == NULL && str != chunk)
+        free(str);
+
+    //every payload byte has gone through the crc now
+    if (ret == e_success && (encInfo->header_flags & FLAG_CRC32C))
+        ret = encode_payload_crc(encInfo);
+    return ret;
+}
+
+/*Function to copy untouched mapped src data with the kernel doing the copy*/
+static Status copy_tail_mapped(EncodeInfo *encInfo, long start)
+{
+    int src_fd = fileno(encInfo->fptr_src_image);
+    int stego_fd = fileno(encInfo->fptr_stego_image);
+    loff_t src_off = start;
+    loff_t dest_off = start;
+    long remaining = encInfo->image_file_size - start;
+    ssize_t ret;
+
+    //copy_file_range keeps the data inside the kernel (or the filesystem)
+    while (remaining > 0)
+    {
+        ret = copy_file_range(src_fd, &src_off, stego_fd, &dest_off, remaining, 0);
+        STATS_ADD(&encInfo->stats, syscalls, 1);
+        if (ret <= 0)
+            break;
+        STATS_ADD(&encInfo->stats, bytes_read, ret);
+        STATS_ADD(&encInfo->stats, bytes_written, ret);
+        remaining -= ret;
+    }
+
+    //older kernels or cross filesystem copies, fall back to sendfile
+    if (remaining > 0 && lseek(stego_fd, dest_off, SEEK_SET) == dest_off)
+    {
+        off_t off = src_off;
+        while (remaining > 0)
+        {
+            ret = sendfile(stego_fd, src_fd, &off, remaining);
+            STATS_ADD(&encInfo->stats, syscalls, 1);
+            if (ret <= 0)
+                break;
+            STATS_ADD(&encInfo->stats, bytes_read, ret);
+            STATS_ADD(&encInfo->stats, bytes_written, ret);
+            remaining -= ret;
+        }
+        src_off = off;
+    }
+
+    //last resort, copy through the mappings
+    if (remaining > 0)
+    {
+        memcpy(encInfo->image_buffer + src_off, encInfo->src_image_map + src_off, remaining);
+        STATS_ADD(&encInfo->stats, bytes_read, remaining);
+        STATS_ADD(&encInfo->stats, bytes_written, remaining);
+    }
+
+    return e_success;
+}
+
+/*Function to write tail of the image buffer at its own offset*/
+static Status write_tail_buffered(EncodeInfo *encInfo, long start)
+{
+    int stego_fd = fileno(encInfo->fptr_stego_image);
+    long off = start;
+    ssize_t ret;
+
+    //positional writes leave the stdio stream position alone
+    while (off < encInfo->image_file_size)
+    {
+        ret = pwrite(stego_fd, encInfo->image_buffer + off, encInfo->image_file_size - off, off);
+        STATS_ADD(&encInfo->stats, syscalls, 1);
+        if (ret <= 0)
+            return e_failure;
+        STATS_ADD(&encInfo->stats, bytes_written, ret);
+        off += ret;
+    }
+    return e_success;
+}
+
+/*Function to copy the untouched tail from start in whatever mode is in use*/
+static Status copy_tail(EncodeInfo *encInfo, long start)
+{
+    if (encInfo->in_memory)
+    {
+        memcpy(encInfo->image_buffer + start, encInfo->src_image_map + start, encInfo->image_file_size - start);
+        STATS_ADD(&encInfo->stats, bytes_read, encInfo->image_file_size - start);
+        STATS_ADD(&encInfo->stats, bytes_written, encInfo->image_file_size - start);
+        return e_success;
+    }
+    if (encInfo->opts.use_mmap)
+        return copy_tail_mapped(encInfo, start);
+    return write_tail_buffered(encInfo, start);
+}
+
+/*Function run by the tail copy thread*/
+static void *tail_copy_thread(void *arg)
+{
+    EncodeInfo *encInfo = arg;
+
+    encInfo->tail_status = copy_tail(encInfo, encInfo->tail_offset);
+    return NULL;
+}
+
+/*Function to start copying the untouched tail on its own thread*/
+Status start_tail_copy(EncodeInfo *encInfo, long tail_offset)
+{
+    if (tail_offset > encInfo->image_file_size)
+        return e_failure;
+
+    encInfo->tail_offset = tail_offset;
+    if (pthread_create(&encInfo->tail_thread, NULL, tail_copy_thread, encInfo) != 0)
+        return e_failure;
+    encInfo->tail_started = 1;
     return e_success;
 }
 
+/*Function to wait for tail copy thread*/
+static Status finish_tail_copy(EncodeInfo *encInfo)
+{
+    if (!encInfo->tail_started)
+        return e_success;
+    pthread_join(encInfo->tail_thread, NULL);
+    encInfo->tail_started = 0;
+    return encInfo->tail_status;
+}
+
 /*Function to copy remainig input bmp file dat to stego image*/
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
+Status copy_remaining_img_data(EncodeInfo *encInfo)
 {
-    char ch;
-    //read 1 byte data at a time from bmp source image
-    while((fread(&ch, 1, 1, fptr_src)) > 0)
+    long end = encInfo->image_file_size;
+
+    //patched carrier: the untouched bytes never left the file
+    if (encInfo->patching)
+        return e_success;
+
+    //pipeline wrote everything from the payload on, the head goes last since the crc sits in it
+    if (encInfo->pipelined)
+    {
+        long off = encInfo->layout.data_offset;
+        ssize_t ret;
+
+        if (fflush(encInfo->fptr_stego_image) != 0)
+            return e_failure;
+        while (off < encInfo->pipe_start)
+        {
+            ret = pwrite(fileno(encInfo->fptr_stego_image), encInfo->image_buffer + off, encInfo->pipe_start - off, off);
+            STATS_ADD(&encInfo->stats, syscalls, 1);
+            if (ret <= 0)
+                return e_failure;
+            STATS_ADD(&encInfo->stats, bytes_written, ret);
+            off += ret;
+        }
+        return e_success;
+    }
+
+    //tail may already be on its way from the parallel encoder
+    if (encInfo->tail_started)
     {
-        //write the data read from source image to destinaton image i.e stego image
-        fwrite(&ch, 1, 1, fptr_dest);
+        if (finish_tail_copy(encInfo) != e_success)
+            return e_failure;
+        end = encInfo->tail_offset;
+    }
+
+    if (encInfo->src_image_map)
+    {
+        if (end == encInfo->image_file_size && copy_tail(encInfo, encInfo->image_copied) != e_success)
+            return e_failure;
+        encInfo->image_copied = encInfo->image_file_size;
+        return e_success;
     }
+
+    //everything after the header up to the tail is written in one call:
+    //the embedded region was modified in place, the rest is untouched
+    long remaining = end - encInfo->layout.data_offset;
+
+    if (fwrite(encInfo->image_buffer + encInfo->layout.data_offset, 1, remaining, encInfo->fptr_stego_image) != (size_t)remaining)
+        return e_failure;
+    if (fflush(encInfo->fptr_stego_image) != 0)
+        return e_failure;
+    STATS_ADD(&encInfo->stats, syscalls, 2);
+    STATS_ADD(&encInfo->stats, bytes_written, remaining);
     return e_success;
 }
 
-Status do_encoding(EncodeInfo *encInfo)
+/*Function to release image buffer and close files*/
+void close_files(EncodeInfo *encInfo)
+{
+    //workers and tail copy use the buffers, stop them first
+    finish_tail_copy(encInfo);
+    if (encInfo->own_pool)
+        threadpool_destroy(encInfo->pool);
+    encInfo->pool = NULL;
+    encInfo->own_pool = 0;
+
+    if (encInfo->opts.use_mmap || encInfo->patching)
+    {
+        if (encInfo->image_buffer)
+            munmap(encInfo->image_buffer, encInfo->image_file_size);
+        if (encInfo->src_image_map && encInfo->src_image_map != encInfo->image_buffer)
+            munmap(encInfo->src_image_map, encInfo->image_file_size);
+        encInfo->src_image_map = NULL;
+        STATS_ADD(&encInfo->stats, syscalls, 2);
+    }
+    else
+        free(encInfo->image_buffer);
+    encInfo->image_buffer = NULL;
+
+    if (encInfo->fptr_src_image)
+    {
+        fclose(encInfo->fptr_src_image);
+        STATS_ADD(&encInfo->stats, syscalls, 1);
+    }
+    if (encInfo->fptr_secret)
+    {
+        fclose(encInfo->fptr_secret);
+        STATS_ADD(&encInfo->stats, syscalls, 1);
+    }
+    if (encInfo->fptr_stego_image)
+    {
+        fclose(encInfo->fptr_stego_image);
+        STATS_ADD(&encInfo->stats, syscalls, 1);
+    }
+    encInfo->fptr_src_image = encInfo->fptr_secret = encInfo->fptr_stego_image = NULL;
+}
+
+/*Function to run encoding phases on already opened source and stego image*/
+Status encode_phases(EncodeInfo *encInfo)
 {
-    if(open_files(encInfo) == e_success)
+    if(STATS_PHASE(&encInfo->stats, STAT_CAPACITY, check_capacity(encInfo)) == e_success) 
     {
-        printf("Open files is a success\n");
-        
-        if(check_capacity(encInfo) == e_success) 
+        PHASE_MSG(encInfo->opts, "check capacity is a success\n");
+
+        if(STATS_PHASE(&encInfo->stats, STAT_HEADER, copy_bmp_header(encInfo)) == e_success)
         {
-            printf("check capacity is a success\n");
+            PHASE_MSG(encInfo->opts, "copied bmp header successfully\n");
 
-            if(copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+            if (STATS_PHASE(&encInfo->stats, STAT_MAGIC, encode_magic_string(encInfo->v2_header ? MAGIC_STRING_V2 : MAGIC_STRING, encInfo)) == e_success)
             {
-                printf("copied bmp header successfully\n");
-
-                if (encode_magic_string(MAGIC_STRING, encInfo) == e_success)
+                PHASE_MSG(encInfo->opts, "Encoded magic string\n");
+                if(STATS_PHASE(&encInfo->stats, STAT_EXTN_SIZE, encode_secret_file_extn_size(strlen(encInfo->extn_secret_file), encInfo)) == e_success)
                 {
-                    printf("Encoded magic string\n");
-                    strcpy(encInfo->extn_secret_file, strstr(encInfo->secret_fname, ".") );
-                    if(encode_secret_file_extn_size(strlen(encInfo->extn_secret_file), encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+                    PHASE_MSG(encInfo->opts, "Encoded secret file extension size\n");
+                    if(STATS_PHASE(&encInfo->stats, STAT_EXTN, encode_secret_file_extn(encInfo->extn_secret_file, encInfo)) == e_success)
                     {
-                        printf("Encoded secret file extension size\n");
-                        if(encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_success)
+                        PHASE_MSG(encInfo->opts, "Encoded secret file extension successfully\n");
+                        if(STATS_PHASE(&encInfo->stats, STAT_FILE_SIZE, encode_secret_file_size(encInfo->size_secret_file, encInfo)) == e_success)
                         {
-                            printf("Encoded secret file extension successfully\n");
-                            if(encode_secret_file_size(encInfo->size_secret_file, encInfo) == e_success)
+                            PHASE_MSG(encInfo->opts, "Encode secret file size successfully\n");
+                            if(STATS_PHASE(&encInfo->stats, STAT_DATA, encode_secret_file_data(encInfo)) == e_success)
                             {
-                                printf("Encode secret file size successfully\n");
-                                if(encode_secret_file_data(encInfo) == e_success)
+                                PHASE_MSG(encInfo->opts, "Encoded secret file data\n");
+                                if(STATS_PHASE(&encInfo->stats, STAT_TAIL, copy_remaining_img_data(encInfo)) == e_success)
                                 {
-                                    printf("Encoded secret file data\n");
-                                    if(copy_remaining_img_data(encInfo-> fptr_src_image, encInfo-> fptr_stego_image) == e_success)
-                                    {
-                                        printf("Copied remaining data\n");
-                                    }
-                                    else
-                                    {
-                                        printf("Failed to copy remaining data\n");
-                                        return e_failure;
-                                    }
+                                    PHASE_MSG(encInfo->opts, "Copied remaining data\n");
                                 }
                                 else
                                 {
-                                    printf("Failed to encode secret file data\n");
+                                    PHASE_MSG(encInfo->opts, "Failed to copy remaining data\n");
                                     return e_failure;
                                 }
                             }
                             else
                             {
-                                printf("Failed to encode secret file size");
+                                PHASE_MSG(encInfo->opts, "Failed to encode secret file data\n");
                                 return e_failure;
                             }
                         }
                         else
                         {
-                            printf("Failed to encode secret file extension\n");
+                            PHASE_MSG(encInfo->opts, "Failed to encode secret file size");
+                            return e_failure;
                         }
                     }
                     else
                     {
-                        printf("Failed to encode secret file extension size\n");
+                        PHASE_MSG(encInfo->opts, "Failed to encode secret file extension\n");
                         return e_failure;
                     }
                 }
                 else
                 {
-                    printf("Failed to encode magic string\n");
+                    PHASE_MSG(encInfo->opts, "Failed to encode secret file extension size\n");
                     return e_failure;
                 }
             }
             else
             {
-                printf("failed to copy bmp header\n");
-                return -1;
+                PHASE_MSG(encInfo->opts, "Failed to encode magic string\n");
+                return e_failure;
             }
         }
         else
         {
-            printf("check capactiy is a failure\n");
+            PHASE_MSG(encInfo->opts, "failed to copy bmp header\n");
             return -1;
         }
     }
     else
     {
-        printf("Open files is a failure\n");
+        PHASE_MSG(encInfo->opts, "check capactiy is a failure\n");
+        PHASE_MSG(encInfo->opts, "secret does not fit, -x splits it over several carriers\n");
         return -1;
     }
     return e_success;
 }
+
+/*Function to run all encoding phases in order*/
+static Status run_encoding(EncodeInfo *encInfo)
+{
+    if(STATS_PHASE(&encInfo->stats, STAT_OPEN, open_files(encInfo)) == e_success)
+    {
+        PHASE_MSG(encInfo->opts, "Open files is a success\n");
+        return encode_phases(encInfo);
+    }
+    else
+    {
+        PHASE_MSG(encInfo->opts, "Open files is a failure\n");
+        return -1;
+    }
+}
+
+/*Function to encode, files are always closed so jobs can run back to back*/
+Status do_encoding(EncodeInfo *encInfo)
+{
+    uint64_t start = stats_now_ns();
+    uint64_t close_start;
+    Status ret = run_encoding(encInfo);
+
+    close_start = stats_now_ns();
+    close_files(encInfo);
+    stats_phase_add(&encInfo->stats, STAT_CLOSE, close_start);
+    encInfo->stats.total_ns = stats_now_ns() - start;
+    return ret;
+}
@@ -1,7 +1,15 @@
 #ifndef ENCODE_H
 #define ENCODE_H
 
+#include <pthread.h>
 #include "types.h" // Contains user defined types
+#include "common.h"
+#include "threadpool.h"
+#include "stats.h"
+#include "carrier.h"
+#include "chacha20.h"
+#include "scatter.h"
+#include "shard.h"
 
 /* 
  * Structure to store information required for
@@ -12,7 +20,22 @@
 
 #define MAX_SECRET_BUF_SIZE 1
 #define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
-#define MAX_FILE_SUFFIX 4
+
+/* Secret bytes read and embedded per step */
+#define ENCODE_CHUNK_SIZE (64 * 1024)
+
+/* Secret bytes embedded by one worker per step in parallel mode */
+#define PARALLEL_SLICE_SIZE (1024 * 1024)
+
+/* Carrier bytes per block of the pipelined encoder, a multiple of 8 */
+#define PIPE_BLOCK_SIZE (1024 * 1024)
+
+/* Image bytes read up front by the pipelined encoder, image and stego headers go here */
+#define ENCODE_HEAD_SIZE (64 * 1024)
+
+/* Patch modes: embed into the carrier file itself, or into a reflink clone of it */
+#define PATCH_IN_PLACE 1
+#define PATCH_CLONE 2
 
 typedef struct _EncodeInfo
 {
@@ -22,18 +45,56 @@ typedef struct _EncodeInfo
     uint image_capacity;
     uint bits_per_pixel;
     char image_data[MAX_IMAGE_BUF_SIZE];
+    char *image_buffer;
+    long image_file_size;
+    long image_pos;         // next logical carrier byte, see layout
+    long image_copied;      // bytes of image_buffer already holding src data
+    char *src_image_map;    // source mapping in mmap mode, source buffer in memory mode
+    const char *src_image_data;     // source image bytes, whatever the mode
+    int in_memory;          // source and stego image are caller buffers
+    int patching;           // stego image already holds the carrier, only embedded bytes change
+    int pipelined;          // image_buffer holds the head only, the data phase streams the rest
+    long pipe_start;        // first file byte written by the pipeline
 
     /* Secret File Info */
     char *secret_fname;
     FILE *fptr_secret;
-    char extn_secret_file[MAX_FILE_SUFFIX];
+    char extn_secret_file[MAX_FILE_SUFFIX + 1];
     char secret_data[MAX_SECRET_BUF_SIZE];
     long size_secret_file;
+    const char *secret_buffer;      // secret held in memory instead of fptr_secret
+    long raw_secret_size;           // secret size before compression
+    long size_pos;                  // carrier offset of the file size field, patched for a compressed payload
+    int archive;                    // secret_buffer holds an archive, see archive.h
+    ShardHeader shard;              // shard fields, count 0 when not sharded
+    uint32_t payload_crc;           // CRC32C of payload embedded so far
+    long crc_pos;                   // carrier offset of the crc field in the header
+    long payload_pos;               // payload bytes embedded so far, keystream offset
+    ChaCha20 cipher;                // key and nonce of an encrypted payload
+    CarrierScatter scatter;         // block order of a scattered payload
+    int lsb_bits;           // payload bits per carrier byte
+    uint header_flags;      // v2 header flags
+    int v2_header;          // write MAGIC_STRING_V2 and the flags word
+    CarrierLayout layout;   // usable pixel bytes of the source image
 
     /* Stego Image Info */
     char *stego_image_fname;
     FILE *fptr_stego_image;
 
+    /* Run time options */
+    StegoOptions opts;
+
+    /* Parallel encoding state */
+    ThreadPool *pool;
+    int own_pool;           // pool was created here, not handed in
+    pthread_t tail_thread;
+    int tail_started;
+    long tail_offset;       // first byte after the embedded region
+    Status tail_status;
+
+    /* Timers and counters */
+    StegoStats stats;
+
 } EncodeInfo;
 
 
@@ -42,32 +103,53 @@ typedef struct _EncodeInfo
 /* Check operation type */
 OperationType check_operation_type(char *argv[]);
 
+/* Strip --options from argv, returns new argc */
+int parse_options(int argc, char *argv[], StegoOptions *opts);
+
 /* Read and validate Encode args from argv */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo);
 
 /* Perform the encoding */
 Status do_encoding(EncodeInfo *encInfo);
 
+/* Run all phases after the source and stego image are set up */
+Status encode_phases(EncodeInfo *encInfo);
+
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Get extension of secret file, empty if it has none */
+Status get_secret_file_extn(const char *fname, char *extn);
+
 /* check capacity */
 Status check_capacity(EncodeInfo *encInfo);
 
-/* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
+/* Largest secret the carrier layout holds with the header flags set, -1 if not even the header fits */
+long encode_payload_capacity(EncodeInfo *encInfo);
 
 /* Get file size */
 uint get_file_size(FILE *fptr);
 
+/* Read whole source image into memory */
+Status read_src_image(EncodeInfo *encInfo);
+
+/* Map source and stego image instead of reading */
+Status map_src_image(EncodeInfo *encInfo);
+
+/* Map the stego image, already holding the carrier, to be patched in place */
+Status map_patch_image(EncodeInfo *encInfo);
+
+/* Make sure image buffer holds src data for carrier bytes up to image_pos + len */
+Status prepare_image_span(EncodeInfo *encInfo, long len);
+
 /* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+Status copy_bmp_header(EncodeInfo *encInfo);
 
-/* Store Magic String */
+/* Store Magic String, and the flags word after a v2 magic string */
 Status encode_magic_string(char *magic_string, EncodeInfo *encInfo);
 
 /* Encode secret file extension size */
-Status encode_secret_file_extn_size(int size, FILE *fptr_src_image, FILE *fptr_stego_image);
+Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
 
 /* Encode secret file extenstion */
 Status encode_secret_file_extn( char *file_extn, EncodeInfo *encInfo);
@@ -79,15 +161,24 @@ Status encode_secret_file_size(int file_size, EncodeInfo *encInfo);
 Status encode_secret_file_data(EncodeInfo *encInfo);
 
 /* Encode function, which does the real encoding */
-Status encode_data_to_image(char *data, int size, FILE *fptr_src_image, FILE *fptr_stego_image, EncodeInfo *encInfo);
+Status encode_data_to_image(char *data, int size, EncodeInfo *encInfo);
+
+/* Encode payload bytes at lsb_bits bits per carrier byte */
+Status encode_payload_to_image(char *data, long size, EncodeInfo *encInfo);
 
-/* Encode a byte into LSB of image data array */
-Status encode_byte_to_lsb(char data, char *image_buffer);
+/* Encode the payload with reader, embed and writer stages running side by side */
+Status encode_data_pipelined(EncodeInfo *encInfo);
 
-/*Encode size to lsb */
-Status encode_size_to_lsb(int size, char *image_buffer);
+/* Encode data with the payload split across the thread pool */
+Status encode_data_parallel(char *data, long size, EncodeInfo *encInfo);
+
+/* Start copying the untouched tail from tail_offset on its own thread */
+Status start_tail_copy(EncodeInfo *encInfo, long tail_offset);
 
 /* Copy remaining image bytes from src to stego image after encoding */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
+Status copy_remaining_img_data(EncodeInfo *encInfo);
+
+/* Release image buffer and close files */
+void close_files(EncodeInfo *encInfo);
 
 #endif
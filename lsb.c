@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <string.h>
+#include "lsb.h"
+#include "types.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LSB_X86 1
+#endif
+
+typedef void (*embed_fn)(char *carrier, const char *data, long n);
+typedef void (*extract_fn)(const unsigned char *carrier, char *data, long n);
+
+/* Kernel table entry */
+typedef struct
+{
+    const char *name;
+    embed_fn embed;
+    extract_fn extract;
+} LsbKernel;
+
+/*Scalar kernel, one carrier byte per payload bit*/
+static void embed_scalar(char *carrier, const char *data, long n)
+{
+    long i;
+    int j;
+
+    for(i = 0 ; i < n ; i++)
+    {
+        unsigned char ch = data[i];
+        for(j = 0 ; j < 8 ; j++)
+        {
+            carrier[j] = (carrier[j] & 0xFE) | ((ch >> (7 - j)) & 0x01);
+        }
+        carrier += 8;
+    }
+}
+
+/*Scalar extract, shift in one lsb per carrier byte*/
+static void extract_scalar(const unsigned char *carrier, char *data, long n)
+{
+    long i;
+    int j;
+
+    for(i = 0 ; i < n ; i++)
+    {
+        unsigned char ch = 0;
+        for(j = 0 ; j < 8 ; j++)
+        {
+            ch = (ch << 1) | (carrier[j] & 0x01);
+        }
+        data[i] = ch;
+        carrier += 8;
+    }
+}
+
+#ifdef LSB_X86
+
+/* Bit order reversal of a byte, movemask gives carrier byte 0 in bit 0 */
+static unsigned char reverse_bits[256];
+
+/*Function to fill bit reversal table*/
+static void init_reverse_bits(void)
+{
+    int i, j;
+
+    for(i = 0 ; i < 256 ; i++)
+    {
+        unsigned char r = 0;
+        for(j = 0 ; j < 8 ; j++)
+        {
+            if (i & (1 << j))
+                r |= 0x80 >> j;
+        }
+        reverse_bits[i] = r;
+    }
+}
+
+/*SSE2 extract, movemask gathers 16 lsbs per step*/
+__attribute__((target("sse2")))
+static void extract_sse2(const unsigned char *carrier, char *data, long n)
+{
+    long i = 0;
+
+    for( ; i + 2 <= n ; i += 2)
+    {
+        //move lsb of every byte into its sign bit
+        __m128i c = _mm_loadu_si128((const __m128i *)(carrier + i * 8));
+        int mask = _mm_movemask_epi8(_mm_slli_epi64(c, 7));
+
+        data[i] = reverse_bits[mask & 0xFF];
+        data[i + 1] = reverse_bits[(mask >> 8) & 0xFF];
+    }
+    extract_scalar(carrier + i * 8, data + i, n - i);
+}
+
+/*AVX2 extract, 64 carrier bytes into 8 payload bytes per step*/
+__attribute__((target("avx2")))
+static void extract_avx2(const unsigned char *carrier, char *data, long n)
+{
+    //reverse byte order inside each group of 8 so movemask yields msb first
+    const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                             7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    long i = 0;
+
+    for( ; i + 8 <= n ; i += 8)
+    {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(carrier + i * 8));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(carrier + i * 8 + 32));
+        uint32_t m0 = _mm256_movemask_epi8(_mm256_slli_epi64(_mm256_shuffle_epi8(lo, reverse), 7));
+        uint32_t m1 = _mm256_movemask_epi8(_mm256_slli_epi64(_mm256_shuffle_epi8(hi, reverse), 7));
+
+        memcpy(data + i, &m0, 4);
+        memcpy(data + i + 4, &m1, 4);
+    }
+    extract_sse2(carrier + i * 8, data + i, n - i);
+}
+
+/*BMI2 extract, pext gathers the lsbs of 8 carrier bytes*/
+__attribute__((target("bmi2")))
+static void extract_bmi2(const unsigned char *carrier, char *data, long n)
+{
+    long i;
+
+    for(i = 0 ; i < n ; i++)
+    {
+        uint64_t c;
+
+        //after bswap carrier byte 0 is the top byte, so it lands in bit 7
+        memcpy(&c, carrier + i * 8, 8);
+        data[i] = _pext_u64(__builtin_bswap64(c), 0x0101010101010101ULL);
+    }
+}
+
+/*SSE2 kernel, 2 payload bytes into 16 carrier bytes per step*/
+__attribute__((target("sse2")))
+static void embed_sse2(char *carrier, const char *data, long n)
+{
+    //lane j tests bit (7 - j % 8) of its payload byte
+    const __m128i bitsel = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i keep = _mm_set1_epi8((char)0xFE);
+    const __m128i one = _mm_set1_epi8(1);
+    long i = 0;
+
+    for( ; i + 2 <= n ; i += 2)
+    {
+        //spread byte 0 over lanes 0-7 and byte 1 over lanes 8-15
+        __m128i x = _mm_cvtsi32_si128((unsigned char)data[i] | ((unsigned char)data[i + 1] << 8));
+        x = _mm_unpacklo_epi8(x, x);
+        x = _mm_unpacklo_epi16(x, x);
+        x = _mm_unpacklo_epi32(x, x);
+
+        __m128i bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(x, bitsel), bitsel), one);
+        __m128i c = _mm_loadu_si128((__m128i *)(carrier + i * 8));
+        c = _mm_or_si128(_mm_and_si128(c, keep), bits);
+        _mm_storeu_si128((__m128i *)(carrier + i * 8), c);
+    }
+    embed_scalar(carrier + i * 8, data + i, n - i);
+}
+
+/*AVX2 kernel, 4 payload bytes into 32 carrier bytes per step*/
+__attribute__((target("avx2")))
+static void embed_avx2(char *carrier, const char *data, long n)
+{
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bitsel = _mm256_set1_epi64x(0x0102040810204080LL);
+    const __m256i keep = _mm256_set1_epi8((char)0xFE);
+    const __m256i one = _mm256_set1_epi8(1);
+    long i = 0;
+
+    for( ; i + 4 <= n ; i += 4)
+    {
+        int32_t word;
+        memcpy(&word, data + i, 4);
+
+        //every 128 bit lane holds all 4 bytes, pick one per group of 8 lanes
+        __m256i x = _mm256_shuffle_epi8(_mm256_set1_epi32(word), spread);
+        __m256i bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(x, bitsel), bitsel), one);
+        __m256i c = _mm256_loadu_si256((__m256i *)(carrier + i * 8));
+        c = _mm256_or_si256(_mm256_and_si256(c, keep), bits);
+        _mm256_storeu_si256((__m256i *)(carrier + i * 8), c);
+    }
+    embed_sse2(carrier + i * 8, data + i, n - i);
+}
+
+/*BMI2 kernel, pdep spreads one payload byte over 8 carrier bytes*/
+__attribute__((target("bmi2")))
+static void embed_bmi2(char *carrier, const char *data, long n)
+{
+    long i;
+
+    for(i = 0 ; i < n ; i++)
+    {
+        uint64_t c;
+
+        //pdep puts bit k in byte k, bswap makes bit 7 land in byte 0
+        uint64_t bits = __builtin_bswap64(_pdep_u64((unsigned char)data[i], 0x0101010101010101ULL));
+        memcpy(&c, carrier + i * 8, 8);
+        c = (c & 0xFEFEFEFEFEFEFEFEULL) | bits;
+        memcpy(carrier + i * 8, &c, 8);
+    }
+}
+
+#endif
+
+static const LsbKernel kernels[] =
+{
+    { "scalar", embed_scalar, extract_scalar },
+#ifdef LSB_X86
+    { "sse2", embed_sse2, extract_sse2 },
+    { "avx2", embed_avx2, extract_avx2 },
+    { "bmi2", embed_bmi2, extract_bmi2 },
+#endif
+};
+
+static const LsbKernel *active_kernel;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/* Carrier bytes for one payload byte in 2 and 4 bit mode, carrier byte 0 first in memory */
+static uint32_t spread2[256];
+static uint16_t spread4[256];
+
+/*Function to fill multi bit spread tables*/
+static void init_spread_tables(void)
+{
+    int i, j;
+
+    for(i = 0 ; i < 256 ; i++)
+    {
+        unsigned char c2[4], c4[2];
+
+        //most significant bits go to the first carrier byte
+        for(j = 0 ; j < 4 ; j++)
+            c2[j] = (i >> (6 - 2 * j)) & 0x03;
+        for(j = 0 ; j < 2 ; j++)
+            c4[j] = (i >> (4 - 4 * j)) & 0x0F;
+        memcpy(&spread2[i], c2, 4);
+        memcpy(&spread4[i], c4, 2);
+    }
+}
+
+/*2 bit embed, one table lookup and one 32 bit store per payload byte*/
+static void embed_2bit(char *carrier, const char *data, long n)
+{
+    long i;
+
+    for(i = 0 ; i < n ; i++)
+    {
+        uint32_t c;
+
+        memcpy(&c, carrier + i * 4, 4);
+        c = (c & 0xFCFCFCFCu) | spread2[(unsigned char)data[i]];
+        memcpy(carrier + i * 4, &c, 4);
+    }
+}
+
+/*4 bit embed, one table lookup and one 16 bit store per payload byte*/
+static void embed_4bit(char *carrier, const char *data, long n)
+{
+    long i;
+
+    for(i = 0 ; i < n ; i++)
+    {
+        uint16_t c;
+
+        memcpy(&c, carrier + i * 2, 2);
+        c = (c & 0xF0F0u) | spread4[(unsigned char)data[i]];
+        memcpy(carrier + i * 2, &c, 2);
+    }
+}
+
+/*2 bit extract, a multiply gathers the 4 bit pairs into the top byte*/
+static void extract_2bit(const unsigned char *carrier, char *data, long n)
+{
+    long i;
+
+    for(i = 0 ; i < n ; i++)
+    {
+        uint32_t c;
+        uint64_t x;
+
+        //pairs land in bits 30, 28, 26 and 24, no two partial products overlap
+        memcpy(&c, carrier + i * 4, 4);
+        x = (uint64_t)(c & 0x03030303u) * ((1ULL << 30) | (1ULL << 20) | (1ULL << 10) | 1);
+        data[i] = x >> 24;
+    }
+}
+
+/*4 bit extract, a multiply joins the two nibbles*/
+static void extract_4bit(const unsigned char *carrier, char *data, long n)
+{
+    long i;
+
+    for(i = 0 ; i < n ; i++)
+    {
+        uint16_t c;
+        uint32_t x;
+
+        memcpy(&c, carrier + i * 2, 2);
+        x = (uint32_t)(c & 0x0F0Fu) * ((1u << 12) | 1);
+        data[i] = x >> 8;
+    }
+}
+
+/*Function to pick the widest kernel the cpu supports*/
+static const LsbKernel *detect_kernel(void)
+{
+#ifdef LSB_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return &kernels[2];
+    if (__builtin_cpu_supports("sse2"))
+        return &kernels[1];
+#endif
+    return &kernels[0];
+}
+
+/*Function to set up tables and default kernel once per process*/
+static void init_kernel(void)
+{
+#ifdef LSB_X86
+    init_reverse_bits();
+#endif
+    init_spread_tables();
+    if (active_kernel == NULL)
+        active_kernel = detect_kernel();
+}
+
+/*Function to get active kernel, detecting it on first use*/
+static const LsbKernel *get_kernel(void)
+{
+    pthread_once(&kernel_once, init_kernel);
+    return active_kernel;
+}
+
+/*Function to force a kernel by name*/
+Status lsb_select_kernel(const char *name)
+{
+    uint i;
+
+    pthread_once(&kernel_once, init_kernel);
+    if (strcmp(name, "auto") == 0)
+    {
+        active_kernel = detect_kernel();
+        return e_success;
+    }
+
+    for(i = 0 ; i < sizeof(kernels) / sizeof(kernels[0]) ; i++)
+    {
+        if (strcmp(name, kernels[i].name) != 0)
+            continue;
+#ifdef LSB_X86
+        __builtin_cpu_init();
+        if ((strcmp(name, "sse2") == 0 && !__builtin_cpu_supports("sse2")) ||
+            (strcmp(name, "avx2") == 0 && !__builtin_cpu_supports("avx2")) ||
+            (strcmp(name, "bmi2") == 0 && !__builtin_cpu_supports("bmi2")))
+            return e_failure;
+#endif
+        active_kernel = &kernels[i];
+        return e_success;
+    }
+    return e_failure;
+}
+
+/*Function to get name of kernel in use*/
+const char *lsb_kernel_name(void)
+{
+    return get_kernel()->name;
+}
+
+/*Function to embed n data bytes into low bits of 8 / bits * n carrier bytes*/
+void lsb_embed_bytes_k(char *carrier, const char *data, long n, int bits)
+{
+    if (bits == 2)
+    {
+        pthread_once(&kernel_once, init_kernel);
+        embed_2bit(carrier, data, n);
+    }
+    else if (bits == 4)
+    {
+        pthread_once(&kernel_once, init_kernel);
+        embed_4bit(carrier, data, n);
+    }
+    else
+        get_kernel()->embed(carrier, data, n);
+}
+
+/*Function to extract n data bytes from low bits of 8 / bits * n carrier bytes*/
+void lsb_extract_bytes_k(const unsigned char *carrier, char *data, long n, int bits)
+{
+    if (bits == 2)
+        extract_2bit(carrier, data, n);
+    else if (bits == 4)
+        extract_4bit(carrier, data, n);
+    else
+        get_kernel()->extract(carrier, data, n);
+}
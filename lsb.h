@@ -0,0 +1,27 @@
+#ifndef LSB_H
+#define LSB_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * LSB embed and extract kernels
+ * Every payload bit goes into the lsb of one carrier byte,
+ * most significant bit first. The kernel is picked at run time
+ * from the cpu features, all kernels give identical output.
+ * Multi bit mode packs 2 or 4 bits into the low bits of each
+ * carrier byte, in the same bit order.
+ */
+
+/* Embed n data bytes into the low bits of 8 / bits * n carrier bytes, bits = 1, 2 or 4 */
+void lsb_embed_bytes_k(char *carrier, const char *data, long n, int bits);
+
+/* Extract n data bytes from the low bits of 8 / bits * n carrier bytes, bits = 1, 2 or 4 */
+void lsb_extract_bytes_k(const unsigned char *carrier, char *data, long n, int bits);
+
+/* Force a kernel: "auto", "scalar", "sse2", "avx2" or "bmi2" */
+Status lsb_select_kernel(const char *name);
+
+/* Name of the kernel in use */
+const char *lsb_kernel_name(void);
+
+#endif
@@ -0,0 +1,293 @@
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+#include "types.h"
+
+/* Hash table of last positions of 4 byte sequences */
+#define LZ_HASH_BITS 12
+
+/* Shortest match worth a sequence */
+#define LZ_MIN_MATCH 4
+
+/* Bytes at block end always sent as literals */
+#define LZ_LAST_LITERALS 5
+
+/* Bytes copied per step by the decoder, it may write this far past a run */
+#define LZ_WILD_COPY 16
+
+/* Block header bit of raw blocks */
+#define LZ_RAW_BLOCK 0x80000000u
+
+/*Function to read 32 bits from any alignment*/
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/*Function to write little endian 32 bit value*/
+static void write_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/*Function to hash 4 bytes into a table index*/
+static uint32_t lz_hash(uint32_t seq)
+{
+    return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/*Function to write a length beyond the 15 of a token nibble*/
+static unsigned char *write_length(unsigned char *op, long len)
+{
+    for ( ; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+/*Function to write one sequence, returns NULL when it does not fit before end*/
+static unsigned char *write_sequence(unsigned char *op, unsigned char *end, const unsigned char *lit, long lit_len, long offset, long match_len)
+{
+    unsigned char *token = op++;
+    long extra = match_len - LZ_MIN_MATCH;
+
+    //token, literal lengths and literals are all bounded by lit_len / 255 + 1
+    if (lit_len + lit_len / 255 + match_len / 255 + 5 > end - op)
+        return NULL;
+
+    *token = (lit_len < 15 ? lit_len : 15) << 4;
+    if (lit_len >= 15)
+        op = write_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    //last sequence carries literals only
+    if (match_len == 0)
+        return op;
+
+    *op++ = offset;
+    *op++ = offset >> 8;
+    *token |= extra < 15 ? extra : 15;
+    if (extra >= 15)
+        op = write_length(op, extra - 15);
+    return op;
+}
+
+/*Function to compress one block, returns bytes written or -1 if it did not shrink*/
+static long compress_block(const unsigned char *src, long n, unsigned char *dst)
+{
+    int32_t table[1 << LZ_HASH_BITS];
+    unsigned char *op = dst, *end = dst + n - 1;
+    long ip = 0, anchor = 0;
+    long match_limit = n - LZ_LAST_LITERALS;
+
+    //positions are stored + 1, 0 is an empty slot
+    memset(table, 0, sizeof(table));
+
+    while (ip + LZ_MIN_MATCH <= match_limit)
+    {
+        uint32_t seq = read32(src + ip);
+        uint32_t h = lz_hash(seq);
+        long ref = table[h] - 1;
+        long len;
+
+        table[h] = ip + 1;
+        if (ref < 0 || read32(src + ref) != seq)
+        {
+            //step faster through data that does not match
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        len = LZ_MIN_MATCH;
+        while (ip + len < match_limit && src[ref + len] == src[ip + len])
+            len++;
+
+        op = write_sequence(op, end, src + anchor, ip - anchor, ip - ref, len);
+        if (op == NULL)
+            return -1;
+        ip += len;
+        anchor = ip;
+    }
+
+    op = write_sequence(op, end, src + anchor, n - anchor, 0, 0);
+    return op ? op - dst : -1;
+}
+
+/*Function to get worst case output size for n bytes of input*/
+long lz_compress_bound(long n)
+{
+    //raw blocks only add their header
+    return n + (n / LZ_BLOCK_SIZE + 1) * 4;
+}
+
+/*Function to compress n bytes of src into dst*/
+long lz_compress(const char *src, long n, char *dst)
+{
+    unsigned char *op = (unsigned char *)dst;
+    long done = 0;
+
+    while (done < n)
+    {
+        long len = n - done < LZ_BLOCK_SIZE ? n - done : LZ_BLOCK_SIZE;
+        long size = compress_block((const unsigned char *)src + done, len, op + 4);
+
+        //blocks that do not shrink are kept as they are
+        if (size < 0)
+        {
+            memcpy(op + 4, src + done, len);
+            write_le32(op, len | LZ_RAW_BLOCK);
+            op += 4 + len;
+        }
+        else
+        {
+            write_le32(op, size);
+            op += 4 + size;
+        }
+        done += len;
+    }
+    return op - (unsigned char *)dst;
+}
+
+/*Function to read a length continued past a token nibble*/
+static int read_length(const unsigned char **ip, const unsigned char *end, long *len)
+{
+    unsigned char b;
+
+    do
+    {
+        if (*ip >= end)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/*Function to decompress next block of src into dst*/
+long lz_decompress_block(const char *src, long n, char *dst, long raw_len)
+{
+    const unsigned char *ip, *end;
+    unsigned char *op = (unsigned char *)dst;
+    unsigned char *op_end = op + raw_len;
+    uint32_t header;
+
+    if (n < 4)
+        return -1;
+    header = (unsigned char)src[0] | ((unsigned char)src[1] << 8) | ((unsigned char)src[2] << 16) | ((uint32_t)(unsigned char)src[3] << 24);
+    if ((long)(header & ~LZ_RAW_BLOCK) > n - 4)
+        return -1;
+
+    if (header & LZ_RAW_BLOCK)
+    {
+        if ((long)(header & ~LZ_RAW_BLOCK) != raw_len)
+            return -1;
+        memcpy(dst, src + 4, raw_len);
+        return 4 + raw_len;
+    }
+
+    ip = (const unsigned char *)src + 4;
+    end = ip + header;
+    while (ip < end)
+    {
+        unsigned token = *ip++;
+        long lit_len = token >> 4;
+        long match_len = (token & 15) + LZ_MIN_MATCH;
+        long offset;
+        const unsigned char *match;
+
+        if (lit_len == 15 && read_length(&ip, end, &lit_len) != 0)
+            return -1;
+        if (lit_len > end - ip || lit_len > op_end - op)
+            return -1;
+
+        //short runs copy a fixed 16 bytes when there is room, the tail is rewritten later
+        if (lit_len <= LZ_WILD_COPY && end - ip >= LZ_WILD_COPY && op_end - op >= LZ_WILD_COPY)
+            memcpy(op, ip, LZ_WILD_COPY);
+        else
+            memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        //literals only: end of block
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if ((token & 15) == 15 && read_length(&ip, end, &match_len) != 0)
+            return -1;
+        if (offset == 0 || offset > op - (unsigned char *)dst || match_len > op_end - op)
+            return -1;
+
+        match = op - offset;
+        if (offset < LZ_WILD_COPY)
+        {
+            //short offsets repeat a pattern: lay down 16 bytes of it, then
+            //copy from a whole number of periods back, at least 16 bytes away
+            long first = match_len < LZ_WILD_COPY ? match_len : LZ_WILD_COPY;
+            long i;
+
+            for (i = 0; i < first; i++)
+                op[i] = match[i];
+            op += first;
+            match_len -= first;
+            match = op - offset * ((LZ_WILD_COPY + offset - 1) / offset);
+        }
+
+        //16 bytes a step, source and destination never overlap within a step
+        if (op_end - op >= match_len + LZ_WILD_COPY)
+        {
+            long i;
+
+            for (i = 0; i < match_len; i += LZ_WILD_COPY)
+                memcpy(op + i, match + i, LZ_WILD_COPY);
+            op += match_len;
+        }
+        else
+        {
+            for ( ; match_len >= LZ_WILD_COPY; match_len -= LZ_WILD_COPY, op += LZ_WILD_COPY, match += LZ_WILD_COPY)
+                memcpy(op, match, LZ_WILD_COPY);
+            while (match_len-- > 0)
+                *op++ = *match++;
+        }
+    }
+
+    if (op != op_end)
+        return -1;
+    return 4 + header;
+}
+
+/*Function to get stored size of a block from its header, header included*/
+long lz_block_size(const char *src)
+{
+    uint32_t header = (unsigned char)src[0] | ((unsigned char)src[1] << 8) | ((unsigned char)src[2] << 16) | ((uint32_t)(unsigned char)src[3] << 24);
+
+    return 4 + (long)(header & ~LZ_RAW_BLOCK);
+}
+
+/*Function to decompress a whole stream of raw_len bytes*/
+Status lz_decompress(const char *src, long n, char *dst, long raw_len)
+{
+    long done = 0, used = 0;
+
+    while (done < raw_len)
+    {
+        long len = raw_len - done < LZ_BLOCK_SIZE ? raw_len - done : LZ_BLOCK_SIZE;
+        long size = lz_decompress_block(src + used, n - used, dst + done, len);
+
+        if (size < 0)
+            return e_failure;
+        used += size;
+        done += len;
+    }
+    return used == n ? e_success : e_failure;
+}
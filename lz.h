@@ -0,0 +1,42 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Small LZ codec for payloads, LZ77 with byte aligned sequences
+ * Input is cut in LZ_BLOCK_SIZE blocks compressed on their own, so a
+ * decoder needs one block of output at a time. Each block starts with
+ * a 32 bit little endian word: stored length, top bit set when the
+ * block did not shrink and is kept raw. Raw length of every block is
+ * LZ_BLOCK_SIZE except the last, the caller keeps the total.
+ *
+ * A block is a run of sequences:
+ *   token: literal count (high nibble), match length - 4 (low nibble)
+ *   15 in a nibble means more length bytes follow, 255 means more again
+ *   literals, then a 16 bit little endian offset back into the block
+ * The last sequence has literals only.
+ */
+
+/* Bytes of input compressed as one block, offsets fit in 16 bits */
+#define LZ_BLOCK_SIZE (64 * 1024)
+
+/* Worst case output size for n bytes of input */
+long lz_compress_bound(long n);
+
+/* Compress n bytes of src into dst, returns bytes written */
+long lz_compress(const char *src, long n, char *dst);
+
+/*
+ * Decompress next block of src (n bytes left) into dst, which takes
+ * raw_len bytes. Returns bytes of src used, -1 if the block is damaged
+ */
+long lz_decompress_block(const char *src, long n, char *dst, long raw_len);
+
+/* Bytes of src taken by the block whose 4 byte header is at src */
+long lz_block_size(const char *src);
+
+/* Decompress a whole stream of raw_len bytes */
+Status lz_decompress(const char *src, long n, char *dst, long raw_len);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+#include "carrier.h"
+#include "common.h"
+#include "types.h"
+
+/* Largest sample value of a 1 byte per sample pnm */
+#define PNM_MAX_BYTE_VALUE 255
+
+/* Largest width or height we accept, keeps the raster size in a long */
+#define PNM_MAX_DIM 1000000
+
+/*Function to check for pnm white space*/
+static int pnm_space(unsigned char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/*Function to read next header number, white space and # comments before it are skipped*/
+static Status pnm_number(const unsigned char *header, long header_len, long *pos, long *value)
+{
+    long p = *pos;
+
+    for (;;)
+    {
+        if (p >= header_len)
+            return e_failure;
+        if (header[p] == '#')
+        {
+            //comment runs to the end of the line
+            while (p < header_len && header[p] != '\n' && header[p] != '\r')
+                p++;
+        }
+        else if (pnm_space(header[p]))
+            p++;
+        else
+            break;
+    }
+
+    if (header[p] < '0' || header[p] > '9')
+        return e_failure;
+    for (*value = 0; p < header_len && header[p] >= '0' && header[p] <= '9'; p++)
+    {
+        *value = *value * 10 + (header[p] - '0');
+        if (*value > PNM_MAX_DIM)
+            return e_failure;
+    }
+    *pos = p;
+    return e_success;
+}
+
+/*Function to build layout from binary ppm (P6) or pgm (P5) header*/
+Status pnm_parse_layout(const unsigned char *header, long header_len, long file_size, CarrierLayout *layout)
+{
+    long pos = 2, width, height, maxval;
+
+    memset(layout, 0, sizeof(*layout));
+    if (header_len < 3 || header[0] != 'P' || (header[1] != '5' && header[1] != '6'))
+        return e_failure;
+    layout->format = "pnm";
+
+    if (pnm_number(header, header_len, &pos, &width) != e_success ||
+        pnm_number(header, header_len, &pos, &height) != e_success ||
+        pnm_number(header, header_len, &pos, &maxval) != e_success)
+        return e_failure;
+
+    //one white space byte ends the header, 16 bit samples are not supported
+    if (width <= 0 || height <= 0 || maxval <= 0 || maxval > PNM_MAX_BYTE_VALUE ||
+        pos >= header_len || !pnm_space(header[pos]))
+        return e_failure;
+
+    //samples are packed with no row padding, every byte carries payload
+    layout->data_offset = pos + 1;
+    layout->pixel_stride = header[1] == '6' ? 3 : 1;
+    layout->rows = height;
+    layout->row_bytes = layout->row_stride = width * layout->pixel_stride;
+    layout->capacity = layout->row_bytes * layout->rows;
+    layout->contiguous = 1;
+
+    if (layout->data_offset + layout->capacity > file_size)
+        return e_failure;
+    return e_success;
+}
@@ -0,0 +1,48 @@
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "ring.h"
+#include "types.h"
+
+/*Function to set up an empty ring*/
+void ring_init(Ring *ring)
+{
+    memset(ring, 0, sizeof(*ring));
+}
+
+/*Function to add a slot at the tail of the ring*/
+void ring_push(Ring *ring, int slot)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    //entry is written before the tail that publishes it
+    ring->slot[tail % RING_SLOTS] = slot;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    //only pay for the syscall when the consumer went to sleep
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, &ring->tail, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/*Function to take the slot at the head of the ring*/
+int ring_pop(Ring *ring)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t tail;
+    int slot;
+
+    while ((tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) == head)
+    {
+        //announce the wait, then look again: a push in between changes tail and the wait returns at once
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head)
+            syscall(SYS_futex, &ring->tail, FUTEX_WAIT_PRIVATE, head, NULL, NULL, 0);
+        __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+    }
+
+    slot = ring->slot[head % RING_SLOTS];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return slot;
+}
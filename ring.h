@@ -0,0 +1,36 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Bounded single producer, single consumer ring of slot numbers
+ * Stages of a pipeline pass a fixed set of at most RING_SLOTS buffers
+ * around through rings, so a push never finds the ring full. Push and
+ * pop are lock free: head and tail are only written by their own side.
+ * An empty pop sleeps on a futex and the next push wakes it, a stage
+ * waiting for the disk does not spin a core.
+ */
+
+/* Slots a ring holds, a power of two */
+#define RING_SLOTS 8
+
+typedef struct _Ring
+{
+    uint32_t head;          // next entry to pop, written by the consumer
+    uint32_t tail;          // next entry to push, written by the producer
+    int waiting;            // consumer sleeps on tail
+    int slot[RING_SLOTS];
+} Ring;
+
+/* Set up an empty ring */
+void ring_init(Ring *ring);
+
+/* Add slot at the tail, wakes a waiting consumer */
+void ring_push(Ring *ring, int slot);
+
+/* Take the slot at the head, waits while the ring is empty */
+int ring_pop(Ring *ring);
+
+#endif
@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "scan.h"
+#include "decode.h"
+#include "threadpool.h"
+#include "stats.h"
+#include "common.h"
+#include "types.h"
+
+/* One file of a batch */
+typedef struct
+{
+    char *path;
+    int fd;
+    long size;              // file size, header decoding checks against it
+    long len;               // head bytes read, -1 on error
+    struct iovec iov;       // head buffer, io_uring reads through it
+    DecodeInfo decInfo;
+    Status status;
+} ScanEntry;
+
+/* io_uring set up with raw syscalls, no liburing needed */
+typedef struct
+{
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+} ScanRing;
+
+/* Walk state, one batch in flight at a time */
+typedef struct
+{
+    StegoOptions opts;
+    ScanEntry entries[SCAN_BATCH];
+    int count;
+    unsigned char *heads;   // SCAN_BATCH head buffers of DECODE_HEAD_SIZE
+    int use_ring;
+    ScanRing ring;
+    ThreadPool *pool;
+    long files, matches;
+    StegoStats stats;       // summed over all files
+} ScanState;
+
+/* Task argument, a run of entries read with pread */
+typedef struct
+{
+    ScanState *state;
+    int first, count;
+} ScanTask;
+
+/*Function to unmap and close the ring*/
+static void ring_exit(ScanRing *ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/*Function to map a ring area, NULL on failure*/
+static void *ring_map(int fd, size_t size, off_t offset)
+{
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/*Function to set up an io_uring with entries submission slots*/
+static Status ring_init(ScanRing *ring, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        return e_failure;
+
+    //newer kernels map both rings with one call
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = ring_map(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+    if (ring->sq_ring && (p.features & IORING_FEAT_SINGLE_MMAP))
+        ring->cq_ring = ring->sq_ring;
+    else if (ring->sq_ring)
+        ring->cq_ring = ring_map(ring->fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = ring_map(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+    if (ring->sq_ring == NULL || ring->cq_ring == NULL || ring->sqes == NULL)
+    {
+        ring_exit(ring);
+        return e_failure;
+    }
+
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ring + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ring + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ring + p.sq_off.array);
+    ring->cq_head = (unsigned *)((char *)ring->cq_ring + p.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ring + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ring + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + p.cq_off.cqes);
+    return e_success;
+}
+
+/*Function to read the head of every open entry with one submission*/
+static Status ring_read_heads(ScanState *state)
+{
+    ScanRing *ring = &state->ring;
+    unsigned tail = *ring->sq_tail;
+    int queued = 0, submitted = 0, done = 0, i;
+
+    for (i = 0; i < state->count; i++)
+    {
+        ScanEntry *e = &state->entries[i];
+        unsigned idx = tail & *ring->sq_mask;
+        struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+        if (e->fd < 0)
+            continue;
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = e->fd;
+        sqe->addr = (unsigned long)&e->iov;
+        sqe->len = 1;
+        sqe->off = 0;
+        sqe->user_data = i;
+        ring->sq_array[idx] = idx;
+        tail++;
+        queued++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    //submit everything, then reap until every read has completed
+    while (done < queued)
+    {
+        unsigned head, ctail;
+        int ret = syscall(__NR_io_uring_enter, ring->fd, queued - submitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        STATS_ADD(&state->stats, syscalls, 1);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return e_failure;
+        }
+        submitted += ret;
+
+        head = *ring->cq_head;
+        ctail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for ( ; head != ctail; head++, done++)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+            state->entries[cqe->user_data].len = cqe->res < 0 ? -1 : cqe->res;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return e_success;
+}
+
+/*Function to open entry and find its size*/
+static void open_entry(ScanEntry *e)
+{
+    struct stat st;
+
+    e->len = -1;
+    e->fd = open(e->path, O_RDONLY | O_CLOEXEC);
+    STATS_ADD(&e->decInfo.stats, syscalls, 1);
+    if (e->fd < 0)
+        return;
+    STATS_ADD(&e->decInfo.stats, syscalls, 1);
+    if (fstat(e->fd, &st) != 0)
+    {
+        close(e->fd);
+        e->fd = -1;
+        return;
+    }
+    e->size = st.st_size;
+}
+
+/*Function to close entry file*/
+static void close_entry(ScanEntry *e)
+{
+    if (e->fd < 0)
+        return;
+    close(e->fd);
+    STATS_ADD(&e->decInfo.stats, syscalls, 1);
+    e->fd = -1;
+}
+
+/*Function to decode stego header from the head bytes of an entry*/
+static void decode_entry(ScanState *state, ScanEntry *e)
+{
+    DecodeInfo *decInfo = &e->decInfo;
+
+    e->status = e_failure;
+    if (e->len <= 0)
+        return;
+
+    //head block plays the part of read_stego_head, there is no FILE to fall back on
+    decInfo->opts = state->opts;
+    decInfo->opts.quiet = 1;
+    decInfo->stego_image_fname = e->path;
+    decInfo->stego_image_size = e->size;
+    decInfo->head_buf = e->iov.iov_base;
+    decInfo->head_len = e->len;
+    STATS_ADD(&decInfo->stats, bytes_read, e->len);
+    e->status = decode_header_phases(decInfo);
+}
+
+/*Function run by a worker to pread and decode a run of entries*/
+static void pread_task(void *arg)
+{
+    ScanTask *task = arg;
+    int i;
+
+    for (i = task->first; i < task->first + task->count; i++)
+    {
+        ScanEntry *e = &task->state->entries[i];
+
+        open_entry(e);
+        if (e->fd >= 0)
+        {
+            e->len = pread(e->fd, e->iov.iov_base, e->iov.iov_len, 0);
+            STATS_ADD(&e->decInfo.stats, syscalls, 1);
+        }
+        close_entry(e);
+        decode_entry(task->state, e);
+    }
+}
+
+/*Function to read heads of the batch on the thread pool*/
+static void pread_batch(ScanState *state)
+{
+    ScanTask tasks[SCAN_BATCH];
+    int nthreads = threadpool_size(state->pool);
+    int per_task = (state->count + nthreads * 4 - 1) / (nthreads * 4);
+    int ntasks = 0, i;
+
+    //a few runs per worker so stealing evens out slow files
+    for (i = 0; i < state->count; i += per_task, ntasks++)
+    {
+        tasks[ntasks].state = state;
+        tasks[ntasks].first = i;
+        tasks[ntasks].count = state->count - i < per_task ? state->count - i : per_task;
+        if (threadpool_submit(state->pool, pread_task, &tasks[ntasks]) != e_success)
+            pread_task(&tasks[ntasks]);
+    }
+    threadpool_wait(state->pool);
+}
+
+/*Function to read heads of the batch through io_uring*/
+static Status ring_batch(ScanState *state)
+{
+    uint64_t syscalls = state->stats.syscalls;
+    Status ret;
+    int i;
+
+    for (i = 0; i < state->count; i++)
+        open_entry(&state->entries[i]);
+    ret = ring_read_heads(state);
+    for (i = 0; i < state->count; i++)
+        close_entry(&state->entries[i]);
+    if (ret != e_success)
+    {
+        //the batch is redone with pread, which counts its own opens and reads
+        state->stats.syscalls = syscalls;
+        for (i = 0; i < state->count; i++)
+            memset(&state->entries[i].decInfo.stats, 0, sizeof(StegoStats));
+        return e_failure;
+    }
+
+    for (i = 0; i < state->count; i++)
+        decode_entry(state, &state->entries[i]);
+    return e_success;
+}
+
+/*Function to scan the current batch and report matches in walk order*/
+static void scan_batch(ScanState *state)
+{
+    int i;
+
+    if (state->count == 0)
+        return;
+
+    //a failing ring is dropped for good, the batch is redone with pread
+    if (state->use_ring && ring_batch(state) != e_success)
+    {
+        ring_exit(&state->ring);
+        state->use_ring = 0;
+    }
+    if (!state->use_ring)
+        pread_batch(state);
+
+    for (i = 0; i < state->count; i++)
+    {
+        ScanEntry *e = &state->entries[i];
+
+        state->files++;
+        if (e->status == e_success)
+        {
+            state->matches++;
+            print_stego_header(e->path, &e->decInfo);
+        }
+        stats_merge(&state->stats, &e->decInfo.stats);
+        free(e->path);
+    }
+    state->count = 0;
+}
+
+/*Function to queue a file, scanning the batch once it is full*/
+static void add_entry(ScanState *state, char *path)
+{
+    ScanEntry *e = &state->entries[state->count];
+
+    memset(&e->decInfo, 0, sizeof(e->decInfo));
+    e->path = path;
+    e->fd = -1;
+    e->size = 0;
+    e->len = -1;
+    e->iov.iov_base = state->heads + (long)state->count * DECODE_HEAD_SIZE;
+    e->iov.iov_len = DECODE_HEAD_SIZE;
+    if (++state->count == SCAN_BATCH)
+        scan_batch(state);
+}
+
+/*Function to walk dir, queueing every carrier image, symlinks are not followed*/
+static Status walk_dir(ScanState *state, const char *dir)
+{
+    DIR *dp = opendir(dir);
+    struct dirent *de;
+    Status ret = e_success;
+
+    if (dp == NULL)
+    {
+        perror("opendir");
+        fprintf(stderr, "ERROR: Unable to open directory %s\n", dir);
+        return e_failure;
+    }
+
+    while ((de = readdir(dp)) != NULL)
+    {
+        int type = de->d_type;
+        char *path;
+
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        path = malloc(strlen(dir) + strlen(de->d_name) + 2);
+        if (path == NULL)
+        {
+            ret = e_failure;
+            break;
+        }
+        sprintf(path, "%s/%s", dir, de->d_name);
+
+        //some file systems leave the type to stat
+        if (type == DT_UNKNOWN)
+        {
+            struct stat st;
+
+            type = DT_LNK;
+            if (lstat(path, &st) == 0)
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+        }
+
+        if (type == DT_DIR)
+        {
+            if (walk_dir(state, path) != e_success)
+                ret = e_failure;
+            free(path);
+        }
+        else if (type == DT_REG && carrier_stego_name(de->d_name) != NULL)
+            add_entry(state, path);
+        else
+            free(path);
+    }
+    closedir(dp);
+    return ret;
+}
+
+/*Function to walk dir and print every stego image found*/
+Status run_scan(const char *dir, StegoOptions *opts)
+{
+    ScanState *state = calloc(1, sizeof(ScanState));
+    uint64_t start = stats_now_ns();
+    int nthreads;
+    Status ret;
+
+    if (state == NULL)
+        return e_failure;
+    state->opts = *opts;
+    state->ring.fd = -1;
+
+    //pread fallback runs side by side, same as batch jobs
+    nthreads = opts->threads > 1 ? opts->threads : get_cpu_count();
+    state->heads = malloc((long)SCAN_BATCH * DECODE_HEAD_SIZE);
+    state->pool = threadpool_create(nthreads);
+    if (state->heads == NULL || state->pool == NULL)
+    {
+        free(state->heads);
+        threadpool_destroy(state->pool);
+        free(state);
+        return e_failure;
+    }
+    if (opts->scan_io != SCAN_IO_PREAD)
+        state->use_ring = ring_init(&state->ring, SCAN_BATCH) == e_success;
+    if (opts->scan_io == SCAN_IO_URING && !state->use_ring)
+        fprintf(stderr, "WARNING: io_uring not available, using pread\n");
+
+    ret = walk_dir(state, dir);
+    scan_batch(state);
+    state->stats.total_ns = stats_now_ns() - start;
+
+    PHASE_MSG(*opts, "Scan: %ld files, %ld with stego header, %.3f s, %s reads\n", state->files, state->matches,
+              state->stats.total_ns / 1e9, state->use_ring ? "io_uring" : "pread");
+    if (opts->stats_json)
+        stats_print_json(stdout, "scan", dir, ret, &state->stats);
+
+    if (state->use_ring)
+        ring_exit(&state->ring);
+    threadpool_destroy(state->pool);
+    free(state->heads);
+    free(state);
+    return ret;
+}
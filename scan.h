@@ -0,0 +1,25 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Scan mode: look for stego headers in every .bmp under a directory
+ * Files go in batches: opened, head read, header decoded, closed.
+ * Head reads of a batch are submitted to io_uring in one call, if
+ * the kernel does not have it they run as preads on a thread pool.
+ * Only files carrying a stego header are reported.
+ */
+
+/* Files handled per batch, also the io_uring queue depth */
+#define SCAN_BATCH 256
+
+/* Head read back ends for --io= */
+#define SCAN_IO_AUTO 0
+#define SCAN_IO_URING 1
+#define SCAN_IO_PREAD 2
+
+/* Walk dir and print every stego image found */
+Status run_scan(const char *dir, StegoOptions *opts);
+
+#endif
@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include <string.h>
+#include "scatter.h"
+#include "chacha20.h"
+
+/* Nonce of the round key stream, keeps it apart from payload encryption */
+static const unsigned char scatter_nonce[CHACHA20_NONCE_SIZE] = "scatter-perm";
+
+/*Function to mix 32 bits, murmur3 finaliser*/
+static uint32_t scatter_mix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+}
+
+/*Function to set up block order for key*/
+Status scatter_init(CarrierScatter *scatter, const unsigned char *key, long start, long capacity, long len)
+{
+    ChaCha20 cipher;
+
+    memset(scatter, 0, sizeof(*scatter));
+    scatter->start = start;
+    scatter->nblocks = capacity > start ? (capacity - start) / SCATTER_BLOCK : 0;
+    if (len > scatter->nblocks * SCATTER_BLOCK)
+        return e_failure;
+
+    //smallest even bit domain holding every block number
+    scatter->half_bits = 1;
+    while ((1L << (2 * scatter->half_bits)) < scatter->nblocks)
+        scatter->half_bits++;
+
+    //round keys are keystream of the payload key under a fixed nonce
+    chacha20_init(&cipher, key, scatter_nonce);
+    chacha20_xor(&cipher, 0, (char *)scatter->keys, (const char *)scatter->keys, sizeof(scatter->keys));
+    return e_success;
+}
+
+/*Function to get the carrier block that block number b of the stream is moved to*/
+static long scatter_block(const CarrierScatter *scatter, long b)
+{
+    uint32_t mask = (1u << scatter->half_bits) - 1;
+    uint32_t v = b;
+    int i;
+
+    //permutation of the power of two domain, walk the cycle until it lands in range
+    do
+    {
+        uint32_t l = v >> scatter->half_bits, r = v & mask;
+
+        for (i = 0; i < SCATTER_ROUNDS; i++)
+        {
+            uint32_t t = l ^ (scatter_mix(r ^ scatter->keys[i]) & mask);
+
+            l = r;
+            r = t;
+        }
+        v = (l << scatter->half_bits) | r;
+    } while (v >= (uint32_t)scatter->nblocks);
+    return v;
+}
+
+/*Function to map stream offset to logical carrier offset*/
+long scatter_pos(const CarrierScatter *scatter, long pos)
+{
+    long rel = pos - scatter->start;
+
+    return scatter->start + scatter_block(scatter, rel / SCATTER_BLOCK) * SCATTER_BLOCK + rel % SCATTER_BLOCK;
+}
+
+/*Function to get carrier bytes left in the block of stream offset pos*/
+long scatter_run(const CarrierScatter *scatter, long pos)
+{
+    return SCATTER_BLOCK - (pos - scatter->start) % SCATTER_BLOCK;
+}
@@ -0,0 +1,43 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Keyed scatter of the payload over the carrier
+ * The carrier bytes after the header are cut in SCATTER_BLOCK blocks.
+ * Payload goes through the blocks in a key dependent order, within a
+ * block it stays sequential, so embed and extract still stream through
+ * 4 KB at a time. The order is a keyed Feistel permutation of the block
+ * numbers: nothing is stored, encoder and decoder work it out from the
+ * key for each block they reach.
+ */
+
+/* Carrier bytes per block, a multiple of every payload stride */
+#define SCATTER_BLOCK 4096
+
+/* Feistel rounds of the block permutation */
+#define SCATTER_ROUNDS 4
+
+typedef struct _CarrierScatter
+{
+    long start;             // logical carrier offset of the first block
+    long nblocks;           // whole blocks between start and the end of the carrier
+    int half_bits;          // bits per Feistel half, 2^(2 * half_bits) >= nblocks
+    uint32_t keys[SCATTER_ROUNDS];
+} CarrierScatter;
+
+/*
+ * Set up the block order for key over carrier bytes start to capacity
+ * Fails when len carrier bytes of payload do not fit in whole blocks
+ */
+Status scatter_init(CarrierScatter *scatter, const unsigned char *key, long start, long capacity, long len);
+
+/* Logical carrier offset where payload stream offset pos (start based, like the carrier) lands */
+long scatter_pos(const CarrierScatter *scatter, long pos);
+
+/* Carrier bytes from stream offset pos to the end of its block */
+long scatter_run(const CarrierScatter *scatter, long pos);
+
+#endif
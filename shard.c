@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include "shard.h"
+#include "encode.h"
+#include "decode.h"
+#include "lz.h"
+#include "threadpool.h"
+#include "common.h"
+#include "types.h"
+
+/* One shard job, the image state plus how it went */
+typedef struct
+{
+    EncodeInfo encInfo;
+    Status status;
+} EncodeShard;
+
+typedef struct
+{
+    DecodeInfo decInfo;
+    Status status;
+} DecodeShard;
+
+/*Function to get how many secret bytes carrier fname takes as a shard*/
+static long shard_capacity(const char *fname, const StegoOptions *opts, const char *extn)
+{
+    unsigned char header[CARRIER_PARSE_SIZE];
+    EncodeInfo encInfo;
+    struct stat st;
+    size_t len;
+    long cap;
+    FILE *fptr = fopen(fname, "r");
+
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", fname);
+        return -1;
+    }
+    len = fread(header, 1, sizeof(header), fptr);
+    if (fstat(fileno(fptr), &st) != 0)
+        len = 0;
+    fclose(fptr);
+
+    memset(&encInfo, 0, sizeof(encInfo));
+    if (carrier_parse_layout(header, len, st.st_size, &encInfo.layout) != e_success)
+    {
+        fprintf(stderr, "ERROR: %s is not a 24 or 32 bit uncompressed bmp or an 8 bit binary ppm/pgm image\n", fname);
+        return -1;
+    }
+
+    //same header fields check_capacity will ask for
+    encInfo.lsb_bits = opts->lsb_bits ? opts->lsb_bits : 1;
+    encInfo.header_flags = FLAG_SHARD;
+    if (opts->compress)
+        encInfo.header_flags |= FLAG_LZ;
+    if (opts->crc)
+        encInfo.header_flags |= FLAG_CRC32C;
+    if (opts->encrypt)
+        encInfo.header_flags |= FLAG_CHACHA20;
+    if (opts->scatter)
+        encInfo.header_flags |= FLAG_SCATTER;
+    encInfo.v2_header = 1;
+    strcpy(encInfo.extn_secret_file, extn);
+    cap = encode_payload_capacity(&encInfo);
+
+    //a compressed shard is streamed, it has to fit even when no block shrinks
+    if (opts->compress && cap > 0)
+    {
+        cap -= (cap / LZ_BLOCK_SIZE + 1) * 4;
+        if (cap < 0)
+            cap = 0;
+    }
+    return cap;
+}
+
+/*Function run by a worker to encode one shard*/
+static void encode_shard_task(void *arg)
+{
+    EncodeShard *shard = arg;
+
+    shard->status = do_encoding(&shard->encInfo);
+}
+
+/*Function to map the secret file read only*/
+static Status map_secret(const char *fname, char **data, long *size)
+{
+    struct stat st;
+    int fd = open(fname, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", fname);
+        if (fd >= 0)
+            close(fd);
+        return e_failure;
+    }
+    *size = st.st_size;
+    *data = "";
+    if (*size > 0 && (*data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        perror("mmap");
+        close(fd);
+        return e_failure;
+    }
+    close(fd);
+    return e_success;
+}
+
+/*Function to split secret argv[2] over carriers argv[4]..., stego images are named after prefix argv[3]*/
+static Status split_secret(int argc, char *argv[], const StegoOptions *opts)
+{
+    char extn[MAX_FILE_SUFFIX + 1];
+    EncodeShard *shards;
+    ThreadPool *pool;
+    char *secret;
+    long size, done = 0;
+    uint32_t id;
+    int ncarriers = argc - 4, count = 0, failed = 0, i;
+
+    if (ncarriers < 1)
+    {
+        fprintf(stderr, "ERROR: shard needs a secret, a stego name prefix and at least one carrier\n");
+        return e_failure;
+    }
+    if (opts->patch)
+    {
+        fprintf(stderr, "ERROR: --in-place and --clone are not supported with shards\n");
+        return e_failure;
+    }
+    if (get_secret_file_extn(argv[2], extn) != e_success || map_secret(argv[2], &secret, &size) != e_success)
+        return e_failure;
+    shards = calloc(ncarriers, sizeof(EncodeShard));
+    if (shards == NULL || size > UINT32_MAX || getrandom(&id, sizeof(id), 0) != sizeof(id))
+        goto out;
+
+    //carriers are filled in order, every one as full as it gets
+    for (i = 0; i < ncarriers && (done < size || count == 0); i++)
+    {
+        EncodeInfo *encInfo = &shards[count].encInfo;
+        const char *dot = strrchr(argv[4 + i], '.');
+        long cap = shard_capacity(argv[4 + i], opts, extn);
+
+        if (cap < 0)
+            goto out;
+        if (cap == 0)
+            continue;
+        if (cap > size - done)
+            cap = size - done;
+
+        encInfo->opts = *opts;
+        encInfo->opts.quiet = 1;
+        encInfo->opts.threads = 1;
+        encInfo->src_image_fname = argv[4 + i];
+        encInfo->stego_image_fname = malloc(strlen(argv[3]) + 16 + (dot ? strlen(dot) : 4));
+        if (encInfo->stego_image_fname == NULL)
+            goto out;
+        sprintf(encInfo->stego_image_fname, "%s%d%s", argv[3], count, dot && !strchr(dot, '/') ? dot : ".bmp");
+        strcpy(encInfo->extn_secret_file, extn);
+        encInfo->secret_buffer = secret + done;
+        encInfo->size_secret_file = cap;
+        encInfo->shard.index = count;
+        encInfo->shard.id = id;
+        encInfo->shard.offset = done;
+        encInfo->shard.total = size;
+        done += cap;
+        count++;
+    }
+    if (done < size)
+    {
+        fprintf(stderr, "ERROR: carriers hold %ld of the %ld secret bytes\n", done, size);
+        goto out;
+    }
+
+    //shards are independent images, one per core
+    pool = threadpool_create(opts->threads > 1 ? opts->threads : get_cpu_count());
+    for (i = 0; i < count; i++)
+    {
+        shards[i].encInfo.shard.count = count;
+        if (pool == NULL || threadpool_submit(pool, encode_shard_task, &shards[i]) != e_success)
+            encode_shard_task(&shards[i]);
+    }
+    if (pool)
+    {
+        threadpool_wait(pool);
+        threadpool_destroy(pool);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        EncodeInfo *encInfo = &shards[i].encInfo;
+
+        if (opts->stats_json)
+            stats_print_json(stdout, "shard", encInfo->stego_image_fname, shards[i].status, &encInfo->stats);
+        PHASE_MSG(*opts, "shard %d: %s, bytes %u-%ld, %s\n", i + 1, encInfo->stego_image_fname,
+                  encInfo->shard.offset, encInfo->shard.offset + encInfo->size_secret_file,
+                  shards[i].status == e_success ? "ok" : "FAILED");
+        if (shards[i].status != e_success)
+            failed++;
+    }
+    PHASE_MSG(*opts, "Split %ld bytes into %d shards, %d failed\n", size, count, failed);
+
+out:
+    for (i = 0; shards && i < count; i++)
+        free(shards[i].encInfo.stego_image_fname);
+    if (size > 0)
+        munmap(secret, size);
+    free(shards);
+    return count && !failed && done == size ? e_success : e_failure;
+}
+
+/*Function run by a worker to decode one shard into the output mapping*/
+static void decode_shard_task(void *arg)
+{
+    DecodeShard *shard = arg;
+    uint64_t start = stats_now_ns();
+
+    shard->status = STATS_PHASE(&shard->decInfo.stats, STAT_DATA, decode_secret_file_data(&shard->decInfo));
+    shard->decInfo.stats.total_ns += stats_now_ns() - start;
+}
+
+/*Function to read the header of every stego image and check they make one whole set*/
+static Status check_shard_set(DecodeShard *shards, int count)
+{
+    const ShardHeader *first = &shards[0].decInfo.shard;
+    DecodeInfo **order = calloc(count, sizeof(DecodeInfo *));
+    long end = 0;
+    int i;
+
+    if (order == NULL)
+        return e_failure;
+    for (i = 0; i < count; i++)
+    {
+        DecodeInfo *decInfo = &shards[i].decInfo;
+        ShardHeader *sh = &decInfo->shard;
+
+        if (!(decInfo->header_flags & FLAG_SHARD))
+        {
+            fprintf(stderr, "ERROR: %s is not a shard\n", decInfo->stego_image_fname);
+            goto bad;
+        }
+        if (sh->count != (uint32_t)count || sh->id != first->id || sh->total != first->total)
+        {
+            fprintf(stderr, "ERROR: %s is shard %u of %u of payload %08x, expected one of %d of payload %08x\n",
+                    decInfo->stego_image_fname, sh->index + 1, sh->count, sh->id, count, first->id);
+            goto bad;
+        }
+        if (sh->index >= (uint32_t)count || order[sh->index])
+        {
+            fprintf(stderr, "ERROR: %s repeats shard %u\n", decInfo->stego_image_fname, sh->index + 1);
+            goto bad;
+        }
+        order[sh->index] = decInfo;
+    }
+
+    //shards in index order must tile the file exactly
+    for (i = 0; i < count; i++)
+    {
+        if (order[i]->shard.offset != end)
+        {
+            fprintf(stderr, "ERROR: %s starts at byte %u, expected %ld\n", order[i]->stego_image_fname, order[i]->shard.offset, end);
+            goto bad;
+        }
+        end += order[i]->raw_file_size;
+    }
+    if (end != first->total)
+    {
+        fprintf(stderr, "ERROR: shards hold %ld of the %u bytes\n", end, first->total);
+        goto bad;
+    }
+    free(order);
+    return e_success;
+
+bad:
+    free(order);
+    return e_failure;
+}
+
+/*Function to join stego images argv[3]... back into output file argv[2]*/
+static Status join_shards(int argc, char *argv[], const StegoOptions *opts)
+{
+    DecodeShard *shards;
+    ThreadPool *pool;
+    char *out = NULL;
+    long total = 0;
+    int count = argc - 3, failed = 0, fd = -1, i;
+    Status ret = e_failure;
+
+    if (count < 1)
+    {
+        fprintf(stderr, "ERROR: join needs an output file and at least one stego image\n");
+        return e_failure;
+    }
+    shards = calloc(count, sizeof(DecodeShard));
+    if (shards == NULL)
+        return e_failure;
+
+    //headers first, nothing is written until the set is known to be whole
+    for (i = 0; i < count; i++)
+    {
+        DecodeInfo *decInfo = &shards[i].decInfo;
+
+        decInfo->opts = *opts;
+        decInfo->opts.quiet = 1;
+        decInfo->opts.threads = 1;
+        decInfo->stego_image_fname = argv[3 + i];
+        if (open_stego_image(decInfo) != e_success || decode_header_phases(decInfo) != e_success)
+        {
+            fprintf(stderr, "ERROR: %s has no stego header\n", argv[3 + i]);
+            goto out;
+        }
+    }
+    if (check_shard_set(shards, count) != e_success)
+        goto out;
+
+    //output is sized up front, every shard decodes straight into its place
+    total = shards[0].decInfo.shard.total;
+    fd = open(argv[2], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, total) != 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", argv[2]);
+        goto out;
+    }
+    if (total > 0 && (out = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        perror("mmap");
+        out = NULL;
+        goto out;
+    }
+
+    pool = threadpool_create(opts->threads > 1 ? opts->threads : get_cpu_count());
+    for (i = 0; i < count; i++)
+    {
+        DecodeInfo *decInfo = &shards[i].decInfo;
+
+        decInfo->decode_buffer = out ? out + decInfo->shard.offset : "";
+        decInfo->decode_buffer_size = decInfo->raw_file_size;
+        if (pool == NULL || threadpool_submit(pool, decode_shard_task, &shards[i]) != e_success)
+            decode_shard_task(&shards[i]);
+    }
+    if (pool)
+    {
+        threadpool_wait(pool);
+        threadpool_destroy(pool);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        DecodeInfo *decInfo = &shards[i].decInfo;
+
+        if (opts->stats_json)
+            stats_print_json(stdout, "join", argv[3 + i], shards[i].status, &decInfo->stats);
+        PHASE_MSG(*opts, "shard %u: %s, bytes %u-%u, %s\n", decInfo->shard.index + 1, argv[3 + i], decInfo->shard.offset,
+                  decInfo->shard.offset + decInfo->raw_file_size, shards[i].status == e_success ? "ok" : "FAILED");
+        if (shards[i].status != e_success)
+            failed++;
+    }
+    PHASE_MSG(*opts, "Joined %d shards into %s, %ld bytes, %d failed\n", count, argv[2], total, failed);
+    ret = failed ? e_failure : e_success;
+
+out:
+    if (out)
+        munmap(out, total);
+    if (fd >= 0)
+        close(fd);
+    for (i = 0; i < count; i++)
+        Close_files(&shards[i].decInfo);
+    free(shards);
+    return ret;
+}
+
+/*Function to split or join as the options say*/
+Status run_shard(int argc, char *argv[], const StegoOptions *opts)
+{
+    if (opts->join)
+        return join_shards(argc, argv, opts);
+    return split_secret(argc, argv, opts);
+}
@@ -0,0 +1,38 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Shard mode: one payload split across several carriers
+ * Every carrier holds a plain v2 stego image of its slice, flagged
+ * FLAG_SHARD, with five more 32 bit header fields after the nonce:
+ *   shard index, shard count, payload id, offset, total size
+ * Offset and total are in bytes of the original file. Each shard is
+ * sized to its carrier, carriers are filled in argument order and
+ * encoded side by side, one per core. Joining takes the stego images
+ * in any order, checks they form one complete set and decodes them
+ * side by side straight into their offsets of the output file.
+ *
+ *   ./a.out -x secret prefix carrier...       write prefix0.bmp, prefix1.bmp ...
+ *   ./a.out -x --join output stego...         reassemble the secret
+ */
+
+/* Header bytes of the shard fields */
+#define SHARD_HEADER_SIZE 20
+
+/* Shard fields of the header, count is 0 in unsharded images */
+typedef struct _ShardHeader
+{
+    uint32_t index;
+    uint32_t count;
+    uint32_t id;            // random, the same in every shard of one payload
+    uint32_t offset;        // first byte of this shard in the original file
+    uint32_t total;         // size of the original file
+} ShardHeader;
+
+/* Split or join as selected by the options, argv as on the command line */
+Status run_shard(int argc, char *argv[], const StegoOptions *opts);
+
+#endif
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include "stats.h"
+#include "types.h"
+
+/* Phase names in json records, same order as StatPhase */
+static const char *phase_names[STAT_NPHASES] =
+{
+    "open", "capacity", "header", "magic", "extn_size",
+    "extn", "file_size", "data", "tail", "close"
+};
+
+/*Function to add time since start to phase*/
+void stats_phase_add(StegoStats *stats, StatPhase phase, uint64_t start)
+{
+    stats->phase_ns[phase] += stats_now_ns() - start;
+    stats->phase_mask |= 1u << phase;
+}
+
+/*Function to add counters and phase timers of src to dst*/
+void stats_merge(StegoStats *dst, const StegoStats *src)
+{
+    int i;
+
+    for (i = 0; i < STAT_NPHASES; i++)
+        dst->phase_ns[i] += src->phase_ns[i];
+    dst->phase_mask |= src->phase_mask;
+    dst->bytes_read += src->bytes_read;
+    dst->bytes_written += src->bytes_written;
+    dst->syscalls += src->syscalls;
+    dst->carrier_bytes += src->carrier_bytes;
+}
+
+/*Function to print a string as a json string*/
+static void print_json_string(FILE *fptr, const char *str)
+{
+    fputc('"', fptr);
+    for (; str && *str; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', fptr);
+        if ((unsigned char)*str < 0x20)
+            fprintf(fptr, "\\u%04x", *str);
+        else
+            fputc(*str, fptr);
+    }
+    fputc('"', fptr);
+}
+
+/*Function to print stats as one json line*/
+void stats_print_json(FILE *fptr, const char *op, const char *fname, Status status, const StegoStats *stats)
+{
+    int i, first = 1;
+
+    fprintf(fptr, "{\"op\": \"%s\", \"file\": ", op);
+    print_json_string(fptr, fname);
+    fprintf(fptr, ", \"status\": \"%s\", \"total_ns\": %llu, \"bytes_read\": %llu, \"bytes_written\": %llu, "
+            "\"syscalls\": %llu, \"carrier_bytes\": %llu, \"phase_ns\": {",
+            status == e_success ? "ok" : "failed",
+            (unsigned long long)stats->total_ns, (unsigned long long)stats->bytes_read,
+            (unsigned long long)stats->bytes_written, (unsigned long long)stats->syscalls,
+            (unsigned long long)stats->carrier_bytes);
+
+    //only phases that ran, a failed job stops early
+    for (i = 0; i < STAT_NPHASES; i++)
+    {
+        if (!(stats->phase_mask & (1u << i)))
+            continue;
+        fprintf(fptr, "%s\"%s\": %llu", first ? "" : ", ", phase_names[i], (unsigned long long)stats->phase_ns[i]);
+        first = 0;
+    }
+    fprintf(fptr, "}}\n");
+}
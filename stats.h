@@ -0,0 +1,72 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Per job instrumentation: phase timers and I/O counters
+ * Counters are bumped once per call or chunk, never per byte, with
+ * relaxed atomics so worker and tail copy threads can share them.
+ * They are always on, --stats=json only decides if they are printed.
+ */
+
+/* Timed phases, encode and decode use the ones that apply */
+typedef enum
+{
+    STAT_OPEN,
+    STAT_CAPACITY,
+    STAT_HEADER,
+    STAT_MAGIC,
+    STAT_EXTN_SIZE,
+    STAT_EXTN,
+    STAT_FILE_SIZE,
+    STAT_DATA,
+    STAT_TAIL,
+    STAT_CLOSE,
+    STAT_NPHASES
+} StatPhase;
+
+/* Timers and counters of one encode or decode job */
+typedef struct _StegoStats
+{
+    uint64_t phase_ns[STAT_NPHASES];
+    uint phase_mask;            // bit per phase that ran
+    uint64_t total_ns;
+    uint64_t bytes_read;        // from secret, carrier or stego image
+    uint64_t bytes_written;     // to stego image or decoded output, file or buffer
+    uint64_t syscalls;          // open/read/write/seek/map calls, a stdio call counts as one
+    uint64_t carrier_bytes;     // carrier bytes embedded into or extracted from
+} StegoStats;
+
+/* Add n to a counter, safe from any thread */
+#define STATS_ADD(stats, field, n) __atomic_fetch_add(&(stats)->field, (uint64_t)(n), __ATOMIC_RELAXED)
+
+/* Run call as phase, adding its time to stats, evaluates to the Status */
+#define STATS_PHASE(stats, phase, call) __extension__ ({ \
+        uint64_t t0_ = stats_now_ns(); \
+        Status r_ = (call); \
+        stats_phase_add((stats), (phase), t0_); \
+        r_; })
+
+/* Monotonic time in ns */
+static inline uint64_t stats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* Add time since start to phase */
+void stats_phase_add(StegoStats *stats, StatPhase phase, uint64_t start);
+
+/* Add counters and phase timers of src to dst, total_ns is left alone */
+void stats_merge(StegoStats *dst, const StegoStats *src);
+
+/* Print stats as one json line */
+void stats_print_json(FILE *fptr, const char *op, const char *fname, Status status, const StegoStats *stats);
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stego.h"
+#include "encode.h"
+#include "decode.h"
+#include "threadpool.h"
+#include "types.h"
+
+/* Reusable state shared by calls on one context */
+struct _StegoContext
+{
+    StegoOptions opts;
+    ThreadPool *pool;           // kept across calls when threads > 1
+    char extn[MAX_FILE_SUFFIX + 1];
+    char decoded_extn[MAX_FILE_SUFFIX + 1];
+    StegoStats stats;           // of the last call
+};
+
+/*Function to create a context*/
+StegoContext *stego_ctx_new(const StegoOptions *opts)
+{
+    StegoContext *ctx = calloc(1, sizeof(*ctx));
+
+    if (ctx == NULL)
+        return NULL;
+    if (opts)
+        ctx->opts = *opts;
+    else
+        ctx->opts.threads = 1;
+
+    //library callers never want progress messages on stdout
+    ctx->opts.quiet = 1;
+
+    //threads are started once and reused by every call
+    if (ctx->opts.threads > 1)
+    {
+        ctx->pool = threadpool_create(ctx->opts.threads);
+        if (ctx->pool == NULL)
+        {
+            free(ctx);
+            return NULL;
+        }
+    }
+    return ctx;
+}
+
+/*Function to free a context*/
+void stego_ctx_free(StegoContext *ctx)
+{
+    if (ctx == NULL)
+        return;
+    threadpool_destroy(ctx->pool);
+    free(ctx);
+}
+
+/*Function to set extension stored with the next secrets*/
+Status stego_set_extn(StegoContext *ctx, const char *extn)
+{
+    if (extn == NULL)
+        extn = "";
+    if (strlen(extn) > MAX_FILE_SUFFIX)
+        return e_failure;
+    strcpy(ctx->extn, extn);
+    return e_success;
+}
+
+/*Function to encode secret into bmp, writing a full stego image to out*/
+Status stego_encode(StegoContext *ctx, const uint8_t *bmp, size_t len,
+                    const uint8_t *secret, size_t slen, uint8_t *out)
+{
+    EncodeInfo encInfo;
+    uint64_t start = stats_now_ns();
+    Status ret;
+
+    if (len < BMP_HEADER_SIZE)
+        return e_failure;
+
+    //source bytes are copied into out lazily, same as the mmap mode
+    memset(&encInfo, 0, sizeof(encInfo));
+    encInfo.opts = ctx->opts;
+    encInfo.in_memory = 1;
+    encInfo.src_image_map = (char *)bmp;
+    encInfo.src_image_data = (const char *)bmp;
+    encInfo.image_buffer = (char *)out;
+    encInfo.image_file_size = len;
+    encInfo.secret_buffer = (const char *)secret;
+    encInfo.size_secret_file = slen;
+    encInfo.pool = ctx->pool;
+    strcpy(encInfo.extn_secret_file, ctx->extn);
+
+    ret = encode_phases(&encInfo);
+    encInfo.stats.total_ns = stats_now_ns() - start;
+    ctx->stats = encInfo.stats;
+    return ret;
+}
+
+/*Function to decode secret from stego image into out*/
+Status stego_decode(StegoContext *ctx, const uint8_t *bmp, size_t len,
+                    uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    DecodeInfo decInfo;
+    Status ret;
+    uint64_t start = stats_now_ns();
+
+    //the input buffer plays the part of the mapped stego image
+    memset(&decInfo, 0, sizeof(decInfo));
+    decInfo.opts = ctx->opts;
+    decInfo.stego_map = (unsigned char *)bmp;
+    decInfo.stego_image_size = len;
+    decInfo.decode_buffer = (char *)out;
+    decInfo.decode_buffer_size = out_cap;
+    decInfo.pool = ctx->pool;
+
+    ret = decode_phases(&decInfo);
+    decInfo.stats.total_ns = stats_now_ns() - start;
+    ctx->stats = decInfo.stats;
+    if (out_len)
+        *out_len = decInfo.raw_file_size;
+    strcpy(ctx->decoded_extn, decInfo.secret_file_extn);
+    return ret;
+}
+
+/*Function to copy decoded header fields out of decInfo*/
+static void fill_header(const DecodeInfo *decInfo, StegoHeader *hdr)
+{
+    strcpy(hdr->extn, decInfo->secret_file_extn);
+    hdr->payload_size = decInfo->raw_file_size;
+    hdr->stored_size = decInfo->secret_file_size;
+    hdr->lsb_bits = decInfo->lsb_bits;
+    hdr->flags = decInfo->header_flags;
+    hdr->crc = decInfo->stored_crc;
+}
+
+/*Function to read header of stego image in memory*/
+Status stego_probe(StegoContext *ctx, const uint8_t *bmp, size_t len, StegoHeader *hdr)
+{
+    DecodeInfo decInfo;
+    Status ret;
+    uint64_t start = stats_now_ns();
+
+    memset(&decInfo, 0, sizeof(decInfo));
+    decInfo.opts = ctx->opts;
+    decInfo.stego_map = (unsigned char *)bmp;
+    decInfo.stego_image_size = len;
+
+    ret = decode_header_phases(&decInfo);
+    decInfo.stats.total_ns = stats_now_ns() - start;
+    ctx->stats = decInfo.stats;
+    if (ret == e_success)
+        fill_header(&decInfo, hdr);
+    return ret;
+}
+
+/*Function to read header of stego image file*/
+Status stego_probe_file(StegoContext *ctx, const char *path, StegoHeader *hdr)
+{
+    DecodeInfo decInfo;
+    Status ret;
+
+    memset(&decInfo, 0, sizeof(decInfo));
+    decInfo.opts = ctx->opts;
+    decInfo.stego_image_fname = (char *)path;
+
+    ret = probe_stego_image(&decInfo);
+    ctx->stats = decInfo.stats;
+    if (ret == e_success)
+        fill_header(&decInfo, hdr);
+    return ret;
+}
+
+/*Function to get extension found by the last decode*/
+const char *stego_decoded_extn(StegoContext *ctx)
+{
+    return ctx->decoded_extn;
+}
+
+/*Function to get timers and counters of the last call*/
+const StegoStats *stego_last_stats(StegoContext *ctx)
+{
+    return &ctx->stats;
+}
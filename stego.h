@@ -0,0 +1,73 @@
+#ifndef STEGO_H
+#define STEGO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+#include "common.h"
+#include "stats.h"
+
+/*
+ * libstego: encode/decode on caller buffers
+ * Runs the same phases as the command line tool, with the source
+ * image, secret, stego image and decoded data all in memory. No
+ * FILE, no temp files, no progress messages.
+ *
+ * Build as a library from everything but the command line main:
+ *   gcc -O2 -c encode.c decode.c lsb.c threadpool.c stats.c bmp.c pnm.c carrier.c lz.c crc32c.c chacha20.c scatter.c ring.c stego.c
+ *   ar rcs libstego.a encode.o decode.o lsb.o threadpool.o stats.o bmp.o pnm.o carrier.o lz.o crc32c.o chacha20.o scatter.o ring.o stego.o
+ */
+
+typedef struct _StegoContext StegoContext;
+
+/* Stego header found by a probe */
+typedef struct _StegoHeader
+{
+    char extn[MAX_FILE_SUFFIX + 1];
+    size_t payload_size;        // original size of the secret
+    size_t stored_size;         // bytes embedded, smaller when compressed
+    int lsb_bits;               // payload bits per carrier byte
+    uint32_t flags;             // v2 flags word, 0 for the original format
+    uint32_t crc;               // CRC32C of the stored payload when flags has FLAG_CRC32C
+} StegoHeader;
+
+/* Create a context, opts may be NULL for defaults */
+StegoContext *stego_ctx_new(const StegoOptions *opts);
+
+/* Free a context */
+void stego_ctx_free(StegoContext *ctx);
+
+/* Set extension stored with the next secrets, NULL or "" for none */
+Status stego_set_extn(StegoContext *ctx, const char *extn);
+
+/*
+ * Encode secret into bmp, out must hold len bytes
+ * out gets a full stego image, bmp is not modified
+ */
+Status stego_encode(StegoContext *ctx, const uint8_t *bmp, size_t len,
+                    const uint8_t *secret, size_t slen, uint8_t *out);
+
+/*
+ * Decode secret from stego image into out (out_cap bytes)
+ * *out_len is the payload size, also when out is too small,
+ * so callers can size the buffer and call again
+ */
+Status stego_decode(StegoContext *ctx, const uint8_t *bmp, size_t len,
+                    uint8_t *out, size_t out_cap, size_t *out_len);
+
+/*
+ * Read header of stego image in bmp (len bytes), payload is not touched
+ * Fails when bmp carries no stego header
+ */
+Status stego_probe(StegoContext *ctx, const uint8_t *bmp, size_t len, StegoHeader *hdr);
+
+/* Same as stego_probe on a file, header bytes come from a single pread */
+Status stego_probe_file(StegoContext *ctx, const char *path, StegoHeader *hdr);
+
+/* Extension found by the last stego_decode */
+const char *stego_decoded_extn(StegoContext *ctx);
+
+/* Timers and counters of the last stego_encode or stego_decode */
+const StegoStats *stego_last_stats(StegoContext *ctx);
+
+#endif
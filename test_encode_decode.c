@@ -40,11 +40,28 @@ Decoded data: My password is secret :)
 #include <stdlib.h>
 #include "encode.h"
 #include "decode.h"
+#include "batch.h"
+#include "scan.h"
+#include "archive.h"
+#include "shard.h"
+#include "lsb.h"
+#include "threadpool.h"
+#include "stats.h"
 #include "types.h"
 #include <string.h>
 
 int main(int argc , char **argv)
 {
+    StegoOptions opts;
+
+    //pull --options out of argv, positional arguments stay as they were
+    argc = parse_options(argc, argv, &opts);
+    if (argc < 0)
+    {
+        printf("Error!! Unknown option \"%s\"\n", argv[-argc]);
+        return -1;
+    }
+
     if(argc < 3)
     {
         printf("Error!! Invalid number of arguments entered.\nPlease enter minimum 4 valid arguments for encoding and minimum 3 valid arguments for decoding\n");
@@ -53,31 +70,36 @@ int main(int argc , char **argv)
     //Check operation type
     if(check_operation_type(argv) == e_encode)
     {
-        printf("Selected encoding..........\n");
+        PHASE_MSG(opts, "Selected encoding..........\n");
 
         //Declare struture member for encoding
         EncodeInfo encInfo;
+        memset(&encInfo, 0, sizeof(encInfo));
+        encInfo.opts = opts;
 
         //Validate input arguments for encoding 
         if((read_and_validate_encode_args(argv,&encInfo)) == e_success)
         {
-            printf("Read and validate encode arguments is a success\n");
-            printf("<..........Started Encoding..........>\n");
+            PHASE_MSG(opts, "Read and validate encode arguments is a success\n");
+            PHASE_MSG(opts, "<..........Started Encoding..........>\n");
 
             //start encoding
-            if(do_encoding(&encInfo) == e_success)
+            Status ret = do_encoding(&encInfo);
+            if (opts.stats_json)
+                stats_print_json(stdout, "encode", encInfo.src_image_fname, ret, &encInfo.stats);
+            if(ret == e_success)
             {
-                 printf("Encoded successfully\n");
+                 PHASE_MSG(opts, "Encoded successfully\n");
             }
             else
             {
-                printf("Failed to encode\n");
+                PHASE_MSG(opts, "Failed to encode\n");
                 return -1;
             }
         }
         else
         {
-            printf("Read and validate encode argument is a failure\n");
+            PHASE_MSG(opts, "Read and validate encode argument is a failure\n");
             return -1;
         }
     }
@@ -85,38 +107,117 @@ int main(int argc , char **argv)
     //Check if argument type is decoding 
     else if(check_operation_type(argv) == e_decode)
     {
-        printf("Selected decoding..........\n");
+        //every file after -d is a stego image to look at, nothing is written
+        if(opts.probe)
+            return probe_images(argc, argv, &opts) == e_success ? 0 : -1;
+
+        PHASE_MSG(opts, "Selected decoding..........\n");
 
         //Declare struture member for decoding
         DecodeInfo decInfo;
+        memset(&decInfo, 0, sizeof(decInfo));
+        decInfo.opts = opts;
 
         //Validate input arguments for decoding
         if((read_and_validate_decode_args(argv,&decInfo)) == e_success)
         {
-            printf("Read and validate decode arguments is a success\n");
-            printf("<..........Started Decoding..........>\n");
+            PHASE_MSG(opts, "Read and validate decode arguments is a success\n");
+            PHASE_MSG(opts, "<..........Started Decoding..........>\n");
 
             //Start decoding
-            if(do_decoding(&decInfo) == e_success)
+            Status ret = do_decoding(&decInfo);
+            if (opts.stats_json)
+                stats_print_json(stdout, "decode", decInfo.stego_image_fname, ret, &decInfo.stats);
+            if(ret == e_success)
             {
-                printf("Decoded successfully\n");
+                PHASE_MSG(opts, "Decoded successfully\n");
             }
             else
             {
-                printf("Failed to decode\n");
+                PHASE_MSG(opts, "Failed to decode\n");
                 return -1;
             }
         }
         else
         {
-            printf("Read and validate decode argument is a failure\n");
+            PHASE_MSG(opts, "Read and validate decode argument is a failure\n");
             return -1;
         }
     }
 
+    //Check if argument type is batch
+    else if(check_operation_type(argv) == e_batch)
+    {
+        PHASE_MSG(opts, "Selected batch..........\n");
+
+        //every manifest job gets its own encode/decode state
+        if(run_batch(argv[2], &opts) == e_success)
+        {
+            PHASE_MSG(opts, "Batch completed successfully\n");
+        }
+        else
+        {
+            PHASE_MSG(opts, "Batch had failures\n");
+            return -1;
+        }
+    }
+
+    //Check if argument type is scan
+    else if(check_operation_type(argv) == e_scan)
+    {
+        PHASE_MSG(opts, "Selected scan..........\n");
+
+        //only headers are read, matches are printed as they are found
+        if(run_scan(argv[2], &opts) != e_success)
+        {
+            PHASE_MSG(opts, "Scan had errors\n");
+            return -1;
+        }
+    }
+
+    //Check if argument type is archive
+    else if(check_operation_type(argv) == e_archive)
+    {
+        PHASE_MSG(opts, "Selected archive..........\n");
+
+        //create, list or extract one member, as the options say
+        if(run_archive(argc, argv, &opts) != e_success)
+            return -1;
+    }
+
+    //Check if argument type is shard
+    else if(check_operation_type(argv) == e_shard)
+    {
+        PHASE_MSG(opts, "Selected shard..........\n");
+
+        //split the secret over the carriers, or join the stego images back
+        if(run_shard(argc, argv, &opts) != e_success)
+            return -1;
+    }
+
     else
     {
-        printf("Invalid option\nPlease pass for\nEncoding: ./a.out -e  beautiful.bmp secret.txt stego.bmp\nDecoding: ./a.out -d stego.bmp decode.txt\n");
+        printf("Invalid option\nPlease pass for\nEncoding: ./a.out -e  beautiful.bmp secret.txt stego.bmp\nDecoding: ./a.out -d stego.bmp decode.txt\nProbe: ./a.out -d --probe stego.bmp...\nBatch: ./a.out -b manifest\nScan: ./a.out -s directory\n");
+        printf("Archive: ./a.out -a beautiful.bmp stego.bmp file...\n         ./a.out -a --list stego.bmp...\n         ./a.out -a --extract=NAME stego.bmp [output]\n");
+        printf("Shard: ./a.out -x secret prefix carrier.bmp...\n       ./a.out -x --join output stego.bmp...\n");
+        printf("Options:\n  --mmap           map image files instead of reading them\n");
+        printf("  --kernel=NAME    lsb kernel: auto, scalar, sse2, avx2, bmi2\n");
+        printf("  --threads=N      embed/extract payload on N threads, 0 = all cpus\n");
+        printf("  --lsb-bits=N     hide N payload bits per image byte: 1, 2 or 4\n");
+        printf("  --compress       lz compress the secret before hiding it\n");
+        printf("  --crc            store a CRC32C of the hidden bytes (encrypted ones with --key), decoding checks it\n");
+        printf("  --key=FILE       ChaCha20 encrypt the secret with the 32 byte key in FILE\n");
+        printf("  --scatter        with --key, spread the secret over the image in key ordered blocks\n");
+        printf("  --in-place       with -e, embed into the carrier itself, only changed pages are written\n");
+        printf("  --clone          with -e, reflink clone the carrier and patch the clone\n");
+        printf("  --probe          with -d, print header of each stego image, no output file\n");
+        printf("  --range=OFF:LEN  with -d, decode LEN secret bytes from offset OFF only\n");
+        printf("  --list           with -a, print the members of each archive\n");
+        printf("  --extract=NAME   with -a, extract member NAME only\n");
+        printf("  --join           with -x, reassemble the secret from its shards\n");
+        printf("  --io=NAME        scan head reads: auto, uring, pread\n");
+        printf("  --quiet          no progress messages\n");
+        printf("  --stats=json     print timers and counters, one json line per job\n");
     }
     
     return 0;
@@ -128,6 +229,139 @@ OperationType check_operation_type(char *argv[])
         return e_encode;
     if(strcmp(argv[1] , "-d") == 0)
         return e_decode;
+    if(strcmp(argv[1] , "-b") == 0)
+        return e_batch;
+    if(strcmp(argv[1] , "-s") == 0)
+        return e_scan;
+    if(strcmp(argv[1] , "-a") == 0)
+        return e_archive;
+    if(strcmp(argv[1] , "-x") == 0)
+        return e_shard;
     else
         return e_unsupported;
 }
+
+/*Function to read a 32 byte ChaCha20 key from a file*/
+static Status read_key_file(const char *fname, unsigned char *key)
+{
+    FILE *fptr = fopen(fname, "rb");
+    size_t n;
+
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open key file %s\n", fname);
+        return e_failure;
+    }
+    n = fread(key, 1, CHACHA20_KEY_SIZE, fptr);
+    fclose(fptr);
+    if (n != CHACHA20_KEY_SIZE)
+    {
+        fprintf(stderr, "ERROR: key file %s is shorter than %d bytes\n", fname, CHACHA20_KEY_SIZE);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*Function to strip --options from argv
+ * Returns the new argc, or -index of the first unknown option
+ */
+int parse_options(int argc, char *argv[], StegoOptions *opts)
+{
+    int i, n = 1;
+
+    memset(opts, 0, sizeof(*opts));
+    opts->threads = 1;
+    opts->lsb_bits = 1;
+
+    for(i = 1 ; i < argc ; i++)
+    {
+        if(strncmp(argv[i], "--", 2) != 0)
+        {
+            //keep positional argument
+            argv[n++] = argv[i];
+            continue;
+        }
+
+        if(strcmp(argv[i], "--mmap") == 0)
+            opts->use_mmap = 1;
+        else if(strcmp(argv[i], "--quiet") == 0)
+            opts->quiet = 1;
+        else if(strcmp(argv[i], "--probe") == 0)
+            opts->probe = 1;
+        else if(strcmp(argv[i], "--compress") == 0)
+            opts->compress = 1;
+        else if(strcmp(argv[i], "--crc") == 0)
+            opts->crc = 1;
+        else if(strcmp(argv[i], "--scatter") == 0)
+            opts->scatter = 1;
+        else if(strncmp(argv[i], "--range=", 8) == 0)
+        {
+            //offset:length in bytes of the secret file
+            char *end;
+
+            opts->range_offset = strtol(argv[i] + 8, &end, 0);
+            if(*end != ':' || opts->range_offset < 0)
+                return -i;
+            opts->range_length = strtol(end + 1, &end, 0);
+            if(*end != '\0' || opts->range_length <= 0)
+                return -i;
+            opts->range = 1;
+        }
+        else if(strcmp(argv[i], "--in-place") == 0)
+            opts->patch = PATCH_IN_PLACE;
+        else if(strcmp(argv[i], "--clone") == 0)
+            opts->patch = PATCH_CLONE;
+        else if(strcmp(argv[i], "--join") == 0)
+            opts->join = 1;
+        else if(strcmp(argv[i], "--list") == 0)
+            opts->list = 1;
+        else if(strncmp(argv[i], "--extract=", 10) == 0 && argv[i][10] != '\0')
+            opts->member = argv[i] + 10;
+        else if(strncmp(argv[i], "--key=", 6) == 0)
+        {
+            //key file holds the 32 key bytes, encoding and decoding use the same file
+            if(read_key_file(argv[i] + 6, opts->key) != e_success)
+                return -i;
+            opts->encrypt = 1;
+        }
+        else if(strncmp(argv[i], "--io=", 5) == 0)
+        {
+            //auto tries io_uring and quietly falls back to pread
+            if(strcmp(argv[i] + 5, "auto") == 0)
+                opts->scan_io = SCAN_IO_AUTO;
+            else if(strcmp(argv[i] + 5, "uring") == 0)
+                opts->scan_io = SCAN_IO_URING;
+            else if(strcmp(argv[i] + 5, "pread") == 0)
+                opts->scan_io = SCAN_IO_PREAD;
+            else
+                return -i;
+        }
+        else if(strncmp(argv[i], "--lsb-bits=", 11) == 0)
+        {
+            //decoding reads the bit count from the image, this only affects encoding
+            opts->lsb_bits = atoi(argv[i] + 11);
+            if(opts->lsb_bits != 1 && opts->lsb_bits != 2 && opts->lsb_bits != 4)
+                return -i;
+        }
+        else if(strcmp(argv[i], "--stats=json") == 0)
+            opts->stats_json = 1;
+        else if(strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            //0 means one thread per cpu
+            opts->threads = atoi(argv[i] + 10);
+            if(opts->threads <= 0)
+                opts->threads = get_cpu_count();
+        }
+        else if(strncmp(argv[i], "--kernel=", 9) == 0)
+        {
+            //lsb kernel is process wide
+            if(lsb_select_kernel(argv[i] + 9) != e_success)
+                return -i;
+        }
+        else
+            return -i;
+    }
+    argv[n] = NULL;
+    return n;
+}
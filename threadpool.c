@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "threadpool.h"
+#include "types.h"
+
+/* Queued task */
+typedef struct
+{
+    task_fn fn;
+    void *arg;
+} Task;
+
+/* Per worker double ended queue, owner works at the back, thieves at the front */
+typedef struct
+{
+    pthread_mutex_t lock;
+    Task *tasks;
+    int cap;
+    int head;
+    int count;
+} WorkQueue;
+
+struct _ThreadPool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;      // signalled when a task is queued
+    pthread_cond_t work_done;       // signalled when pending drops to 0
+    int queued;                     // tasks sitting in any queue
+    int pending;                    // queued + running tasks
+    int stop;
+    int nthreads;
+    int next_queue;                 // round robin target for outside submits
+    WorkQueue *queues;
+    pthread_t *threads;
+};
+
+/* Worker identity, lets tasks submitted by a worker go to its own queue */
+static __thread ThreadPool *current_pool;
+static __thread int current_worker;
+
+/* Start argument of a worker */
+typedef struct
+{
+    ThreadPool *pool;
+    int index;
+} WorkerArg;
+
+/*Function to append a task at the back of a queue*/
+static Status queue_push(WorkQueue *q, Task task)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->cap)
+    {
+        int cap = q->cap ? q->cap * 2 : 16;
+        Task *tasks = malloc(cap * sizeof(Task));
+        int i;
+
+        if (tasks == NULL)
+        {
+            pthread_mutex_unlock(&q->lock);
+            return e_failure;
+        }
+        for(i = 0 ; i < q->count ; i++)
+            tasks[i] = q->tasks[(q->head + i) % q->cap];
+        free(q->tasks);
+        q->tasks = tasks;
+        q->cap = cap;
+        q->head = 0;
+    }
+    q->tasks[(q->head + q->count) % q->cap] = task;
+    q->count++;
+    pthread_mutex_unlock(&q->lock);
+    return e_success;
+}
+
+/*Function to take the newest task, used by the owning worker*/
+static int queue_pop_back(WorkQueue *q, Task *task)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count > 0)
+    {
+        q->count--;
+        *task = q->tasks[(q->head + q->count) % q->cap];
+        found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+/*Function to take the oldest task, used by thieves*/
+static int queue_pop_front(WorkQueue *q, Task *task)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count > 0)
+    {
+        *task = q->tasks[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+/*Function to find work: own queue first, then steal from the others*/
+static int find_task(ThreadPool *pool, int self, Task *task)
+{
+    int i;
+
+    if (queue_pop_back(&pool->queues[self], task))
+        return 1;
+    for(i = 1 ; i < pool->nthreads ; i++)
+    {
+        if (queue_pop_front(&pool->queues[(self + i) % pool->nthreads], task))
+            return 1;
+    }
+    return 0;
+}
+
+/*Function run by every worker thread*/
+static void *worker_main(void *arg)
+{
+    WorkerArg *warg = arg;
+    ThreadPool *pool = warg->pool;
+    int self = warg->index;
+    Task task;
+
+    free(warg);
+    current_pool = pool;
+    current_worker = self;
+
+    while (1)
+    {
+        if (find_task(pool, self, &task))
+        {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+
+            task.fn(task.arg);
+
+            pthread_mutex_lock(&pool->lock);
+            if (--pool->pending == 0)
+                pthread_cond_broadcast(&pool->work_done);
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        //nothing anywhere, sleep till a task is queued
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->stop)
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        if (pool->queued == 0 && pool->stop)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+/*Function to start a pool of nthreads workers*/
+ThreadPool *threadpool_create(int nthreads)
+{
+    ThreadPool *pool;
+    int i;
+
+    if (nthreads < 1)
+        nthreads = 1;
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+    pool->queues = calloc(nthreads, sizeof(WorkQueue));
+    if (pool->threads == NULL || pool->queues == NULL)
+    {
+        free(pool->threads);
+        free(pool->queues);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    for(i = 0 ; i < nthreads ; i++)
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+
+    //queues exist for all slots, so workers can steal while others start
+    pool->nthreads = nthreads;
+    for(i = 0 ; i < nthreads ; i++)
+    {
+        WorkerArg *warg = malloc(sizeof(*warg));
+
+        if (warg == NULL)
+            break;
+        warg->pool = pool;
+        warg->index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, warg) != 0)
+        {
+            free(warg);
+            break;
+        }
+    }
+
+    //could not start every worker, shut down the ones that did start
+    if (i < nthreads)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = 1;
+        pthread_cond_broadcast(&pool->work_ready);
+        pthread_mutex_unlock(&pool->lock);
+        pool->nthreads = i;
+        threadpool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/*Function to queue a task*/
+Status threadpool_submit(ThreadPool *pool, task_fn fn, void *arg)
+{
+    Task task = { fn, arg };
+    int target;
+
+    //workers keep their own tasks local, outside callers spread them out
+    pthread_mutex_lock(&pool->lock);
+    if (current_pool == pool)
+        target = current_worker;
+    else
+        target = pool->next_queue++ % pool->nthreads;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (queue_push(&pool->queues[target], task) != e_success)
+        return e_failure;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pool->pending++;
+    pthread_cond_signal(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    return e_success;
+}
+
+/*Function to wait till all queued tasks are finished*/
+void threadpool_wait(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*Function to get number of workers*/
+int threadpool_size(ThreadPool *pool)
+{
+    return pool->nthreads;
+}
+
+/*Function to stop workers and free pool*/
+void threadpool_destroy(ThreadPool *pool)
+{
+    int i;
+
+    if (pool == NULL)
+        return;
+
+    //workers drain the queues before they exit
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(i = 0 ; i < pool->nthreads ; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for(i = 0 ; i < pool->nthreads ; i++)
+    {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+        free(pool->queues[i].tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->queues);
+    free(pool->threads);
+    free(pool);
+}
+
+/*Function to get number of online cpus*/
+int get_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+}
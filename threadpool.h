@@ -0,0 +1,36 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Fixed size pool of worker threads with work stealing
+ * Every worker owns a queue: tasks submitted from a worker go to
+ * its own queue, tasks from outside are spread round robin. An idle
+ * worker steals the oldest task of another queue.
+ * threadpool_wait blocks until every submitted task is done
+ */
+
+typedef void (*task_fn)(void *arg);
+
+typedef struct _ThreadPool ThreadPool;
+
+/* Start a pool with nthreads workers */
+ThreadPool *threadpool_create(int nthreads);
+
+/* Queue a task */
+Status threadpool_submit(ThreadPool *pool, task_fn fn, void *arg);
+
+/* Wait till all queued tasks are finished */
+void threadpool_wait(ThreadPool *pool);
+
+/* Number of workers */
+int threadpool_size(ThreadPool *pool);
+
+/* Stop workers and free pool */
+void threadpool_destroy(ThreadPool *pool);
+
+/* Number of online cpus */
+int get_cpu_count(void);
+
+#endif
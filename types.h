@@ -15,7 +15,35 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_batch,
+    e_scan,
+    e_archive,
+    e_shard,
     e_unsupported
 } OperationType;
 
+/* Run time options shared by encoding and decoding */
+typedef struct _StegoOptions
+{
+    int use_mmap;       // map carrier and stego image instead of stdio
+    int threads;        // worker threads for payload embed/extract, 1 = serial
+    int quiet;          // no per phase progress messages
+    int stats_json;     // print one json stats record per job
+    int lsb_bits;       // payload bits per carrier byte: 1, 2 or 4, 0 = 1
+    int probe;          // decode headers only, no output file
+    int scan_io;        // head reads of a scan: SCAN_IO_AUTO, _URING or _PREAD
+    int compress;       // lz compress the payload before embedding
+    int crc;            // store a CRC32C of the payload in the header
+    int encrypt;        // ChaCha20 encrypt the payload with key, decoding needs the same key
+    unsigned char key[32];
+    int scatter;        // spread the payload over the image in key ordered blocks
+    int list;           // with -a, print the members of each archive
+    const char *member; // with -a, archive member to extract
+    int range;          // with -d, decode only range_length secret bytes from range_offset
+    long range_offset;
+    long range_length;
+    int join;           // with -x, reassemble shards instead of splitting
+    int patch;          // encode by patching a copy of the carrier: 0, PATCH_IN_PLACE or PATCH_CLONE
+} StegoOptions;
+
 #endif